@@ -0,0 +1,79 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+
+using namespace dae;
+
+namespace
+{
+	std::atomic<uint64_t> g_NrOfAllocations{};
+	thread_local bool t_IsTracked{ false };
+}
+
+void AllocationCounter::TrackCurrentThread()
+{
+	t_IsTracked = true;
+}
+
+uint64_t AllocationCounter::GetNrOfAllocations()
+{
+	return g_NrOfAllocations.load(std::memory_order_relaxed);
+}
+
+#ifdef _DEBUG
+
+namespace
+{
+	void* Allocate(size_t size)
+	{
+		if (t_IsTracked) g_NrOfAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		if (void* pData{ std::malloc(size ? size : 1) }) return pData;
+		throw std::bad_alloc{};
+	}
+
+	void* AllocateAligned(size_t size, std::align_val_t alignment)
+	{
+		if (t_IsTracked) g_NrOfAllocations.fetch_add(1, std::memory_order_relaxed);
+
+		const size_t alignmentSize{ static_cast<size_t>(alignment) };
+
+#ifdef _MSC_VER
+		void* pData{ _aligned_malloc(size ? size : 1, alignmentSize) };
+#else
+		//aligned_alloc wants the size to be a multiple of the alignment
+		void* pData{ std::aligned_alloc(alignmentSize, (std::max(size, size_t{ 1 }) + alignmentSize - 1) / alignmentSize * alignmentSize) };
+#endif
+
+		if (pData) return pData;
+		throw std::bad_alloc{};
+	}
+
+	void FreeAligned(void* pData)
+	{
+#ifdef _MSC_VER
+		_aligned_free(pData);
+#else
+		std::free(pData);
+#endif
+	}
+}
+
+void* operator new(size_t size) { return Allocate(size); }
+void* operator new[](size_t size) { return Allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return AllocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return AllocateAligned(size, alignment); }
+
+void operator delete(void* pData) noexcept { std::free(pData); }
+void operator delete[](void* pData) noexcept { std::free(pData); }
+void operator delete(void* pData, size_t) noexcept { std::free(pData); }
+void operator delete[](void* pData, size_t) noexcept { std::free(pData); }
+void operator delete(void* pData, std::align_val_t) noexcept { FreeAligned(pData); }
+void operator delete[](void* pData, std::align_val_t) noexcept { FreeAligned(pData); }
+void operator delete(void* pData, size_t, std::align_val_t) noexcept { FreeAligned(pData); }
+void operator delete[](void* pData, size_t, std::align_val_t) noexcept { FreeAligned(pData); }
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+//Debug builds replace the global operator new to count heap allocations
+//Only threads that opted in are counted, so allocations by SDL or the update thread don't show up in the frame statistics
+
+namespace dae
+{
+	namespace AllocationCounter
+	{
+		//Counts the allocations of the calling thread from now on
+		void TrackCurrentThread();
+
+		//Allocations by every tracked thread so far, always 0 when the counter isn't compiled in
+		uint64_t GetNrOfAllocations();
+
+		constexpr bool IS_ENABLED
+		{
+#ifdef _DEBUG
+			true
+#else
+			false
+#endif
+		};
+	}
+}
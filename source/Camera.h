@@ -4,6 +4,7 @@
 #include <SDL_mouse.h>
 
 #include "Math.h"
+#include "DataTypes.h"
 #include "Timer.h"
 #include <algorithm>
 
@@ -46,6 +47,9 @@ namespace dae
 		Matrix viewMatrix{};
 		Matrix projectionMatrix{};
 
+		//World space planes of the view volume, refreshed together with the matrices
+		Frustum frustum{};
+
 		const int sprintSpeedMultiplier{ 3 };
 
 		void Initialize(float aspecRatio, float _fovAngle = 90.f, Vector3 _origin = {0.f,0.f,0.f})
@@ -87,6 +91,11 @@ namespace dae
 			//DirectX Implementation => https://learn.microsoft.com/en-us/windows/win32/direct3d9/d3dxmatrixperspectivefovlh
 		}
 
+		void CalculateFrustum()
+		{
+			frustum = Frustum::FromViewProjection(viewMatrix * projectionMatrix);
+		}
+
 		void Update(Timer* pTimer)
 		{
 			const float deltaTime = pTimer->GetElapsed();
@@ -129,6 +138,7 @@ namespace dae
 			//Update Matrices
 			CalculateViewMatrix();
 			CalculateProjectionMatrix(); //Try to optimize this - should only be called once or when fov/aspectRatio changes
+			CalculateFrustum();
 		}
 	};
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 #include "Math.h"
+#include "FrameArena.h"
+#include "SIMD.h"
 #include "vector"
 
 namespace dae
@@ -14,14 +16,14 @@ namespace dae
 		//Vector3 viewDirection{};
 	};
 
+	//Most values a pipeline can interpolate over a triangle on top of depth, see the varying layouts in Shaders.h
+	constexpr int MAX_VARYINGS{ 3 };
+
+	//A transformed vertex while it is being clipped, only the first Varyings::COUNT varyings of the pipeline are used
 	struct Vertex_Out
 	{
 		Vector4 position{};
-		ColorRGB color{ colors::White };
-		Vector2 uv{};
-		Vector3 normal{};
-		Vector3 tangent{};
-		//Vector3 viewDirection{};
+		float varyings[MAX_VARYINGS]{};
 	};
 
 	struct AABB
@@ -30,25 +32,484 @@ namespace dae
 		Vector2 maxAABB{};
 	};
 
+	//Object space bounds of a mesh, computed once after it is loaded
+	struct BoundingBox
+	{
+		Vector3 min{};
+		Vector3 max{};
+	};
+
+	struct BoundingSphere
+	{
+		Vector3 center{};
+		float radius{};
+	};
+
+	enum class FrustumTest
+	{
+		Outside,
+		Intersecting,
+		Inside
+	};
+
+	//Plane dot(normal, p) + distance = 0, the normal is unit length and points into the frustum
+	struct Plane
+	{
+		Vector3 normal{};
+		float distance{};
+
+		float GetSignedDistance(const Vector3& point) const { return Vector3::Dot(normal, point) + distance; }
+	};
+
+	//World space view volume: left, right, bottom, top, near and far
+	struct Frustum
+	{
+		Plane planes[6]{};
+
+		//Gribb/Hartmann: clip space x, y and z are a dot product of the point with a column of the view projection matrix
+		//Every plane -w <= x <= w, -w <= y <= w and 0 <= z <= w is a sum or difference of two of those columns
+		static Frustum FromViewProjection(const Matrix& viewProjection)
+		{
+			const auto column = [&](int index)
+			{
+				return Vector4{ viewProjection[0][index], viewProjection[1][index], viewProjection[2][index], viewProjection[3][index] };
+			};
+
+			const Vector4 x{ column(0) };
+			const Vector4 y{ column(1) };
+			const Vector4 z{ column(2) };
+			const Vector4 w{ column(3) };
+
+			const Vector4 planes[6]{ w + x, w - x, w + y, w - y, z, w - z };
+
+			Frustum frustum{};
+
+			for (int index{}; index < 6; ++index)
+			{
+				const Vector3 normal{ planes[index].x, planes[index].y, planes[index].z };
+				const float length{ normal.Magnitude() };
+
+				if (length > 0.f) frustum.planes[index] = Plane{ normal / length, planes[index].w / length };
+			}
+
+			return frustum;
+		}
+
+		FrustumTest Test(const BoundingSphere& sphere) const
+		{
+			FrustumTest result{ FrustumTest::Inside };
+
+			for (const Plane& plane : planes)
+			{
+				const float distance{ plane.GetSignedDistance(sphere.center) };
+
+				if (distance < -sphere.radius) return FrustumTest::Outside;
+				if (distance < sphere.radius) result = FrustumTest::Intersecting;
+			}
+
+			return result;
+		}
+
+		//Box given by its center and half extents along the world axes
+		FrustumTest Test(const Vector3& center, const Vector3& extents) const
+		{
+			FrustumTest result{ FrustumTest::Inside };
+
+			for (const Plane& plane : planes)
+			{
+				const float distance{ plane.GetSignedDistance(center) };
+				const float radius{ extents.x * std::abs(plane.normal.x) + extents.y * std::abs(plane.normal.y) + extents.z * std::abs(plane.normal.z) };
+
+				if (distance < -radius) return FrustumTest::Outside;
+				if (distance < radius) result = FrustumTest::Intersecting;
+			}
+
+			return result;
+		}
+	};
+
+	//Triangle that survived setup, with its pixel bounds already clamped to the screen
+	struct Triangle
+	{
+		uint32_t index0{};
+		uint32_t index1{};
+		uint32_t index2{};
+
+		int minX{};
+		int minY{};
+		int maxX{};
+		int maxY{};
+	};
+
+	//Attribute that varies linearly over the screen: start at pixel (minX, minY), plus stepX and stepY per pixel moved
+	struct AttributePlane
+	{
+		float start{};
+		float stepX{};
+		float stepY{};
+	};
+
+	//The attribute planes of a TriangleSetup evaluated at the start of one row, every pixel only adds stepX * dx
+	struct AttributeRow
+	{
+		float depthZ{};
+		float invDepthW{};
+		float varyingsOverW[MAX_VARYINGS]{};
+	};
+
+	//Per triangle constants of the pixel loops, computed once before the triangle is rasterized in a tile
+	struct TriangleSetup
+	{
+		//Barycentric weights of pixel (minX, minY) and their change for one step in x and one step in y
+		float startWeightV0{};
+		float startWeightV1{};
+		float startWeightV2{};
+
+		float stepXWeightV0{};
+		float stepXWeightV1{};
+		float stepXWeightV2{};
+
+		float stepYWeightV0{};
+		float stepYWeightV1{};
+		float stepYWeightV2{};
+
+		//Fixed point edge function opposite each vertex, fill rule bias included, only set up on the subpixel path
+		int64_t startEdgeV0{};
+		int64_t startEdgeV1{};
+		int64_t startEdgeV2{};
+
+		int64_t stepXEdgeV0{};
+		int64_t stepXEdgeV1{};
+		int64_t stepXEdgeV2{};
+
+		int64_t stepYEdgeV0{};
+		int64_t stepYEdgeV1{};
+		int64_t stepYEdgeV2{};
+
+		//Perspective correct attributes as planes over the screen, derived from the weights above
+		//NDC z is already linear in screen space, the varyings are interpolated divided by w and multiplied back per pixel
+		//Only the first Varyings::COUNT planes of the pipeline that set up the triangle are valid
+		AttributePlane depthZ{};
+		AttributePlane invDepthW{};
+		AttributePlane varyingsOverW[MAX_VARYINGS]{};
+
+		int minX{};
+		int minY{};
+		int maxX{};
+		int maxY{};
+
+		//Right edge of the tile being rasterized, vector groups may overrun a span up to here
+		int tileMaxX{};
+	};
+
+	constexpr int NR_OF_SAMPLES{ 4 };
+
+	//Per triangle offsets from the sample point of a pixel to each of its MSAA samples
+	struct MultisampleSetup
+	{
+		int64_t edgeOffsetV0[NR_OF_SAMPLES]{};
+		int64_t edgeOffsetV1[NR_OF_SAMPLES]{};
+		int64_t edgeOffsetV2[NR_OF_SAMPLES]{};
+
+		float depthOffset[NR_OF_SAMPLES]{};
+	};
+
+	//Screen region rasterized by a single thread, it owns this slice of the depth and back buffer
+	struct Tile
+	{
+		int minX{};
+		int minY{};
+		int maxX{};
+		int maxY{};
+
+		//Lives in the frame arena, reallocated at the start of every frame
+		FrameArray<uint32_t> triangleIndices{};
+
+		//Coarsest level of the hierarchical depth, farthest depth in the tile
+		//Refreshed after every mesh, in between it can only be too far which keeps it safe to reject against
+		float maxDepth{};
+
+		//Set the first time the tile gets triangles in a frame, until then its part of the buffers holds last frame
+		bool isCleared{};
+	};
+
 	enum class PrimitiveTopology
 	{
 		TriangleList,
 		TriangleStrip
 	};
 
+	//Which winding gets dropped before binning, front facing triangles are counter-clockwise on screen
+	enum class CullMode
+	{
+		Back,
+		Front,
+		None
+	};
+
+	//Limits of a single meshlet, small enough that its bounds stay tight
+	constexpr uint32_t MAX_MESHLET_VERTICES{ 64 };
+	constexpr uint32_t MAX_MESHLET_TRIANGLES{ 124 };
+
+	//Cluster of consecutive triangles of a triangle list, culled as a whole before its vertices are transformed
+	struct Meshlet
+	{
+		//Triangles [firstTriangle, firstTriangle + nrOfTriangles) of the index buffer
+		uint32_t firstTriangle{};
+		uint32_t nrOfTriangles{};
+
+		//The distinct vertices its triangles use, entries [firstVertex, firstVertex + nrOfVertices) of Mesh::meshletVertices
+		uint32_t firstVertex{};
+		uint32_t nrOfVertices{};
+
+		BoundingSphere boundingSphere{};
+
+		//Every face normal is within the cone angle of the axis, stored as its cosine and sine
+		//A cosine of zero or less means the triangles face too many ways for the cone to ever cull
+		Vector3 coneAxis{};
+		float coneCos{ -1.f };
+		float coneSin{};
+	};
+
 	struct Mesh
 	{
 		std::vector<Vertex> vertices{};
 		std::vector<uint32_t> indices{};
 		PrimitiveTopology primitiveTopology{ PrimitiveTopology::TriangleStrip };
+		//The vertex positions once more as separate x, y and z streams for the batched transform
+		//Zero padded to a whole number of SIMD groups and aligned, so every group is a single aligned load
+		SIMD::AlignedVector<float> positionsX{};
+		SIMD::AlignedVector<float> positionsY{};
+		SIMD::AlignedVector<float> positionsZ{};
+
+		//Transformed vertices, in the frame arena and reallocated every time the mesh is transformed
+		//NDC x, y and z with the clip space w, and varyingCount floats per vertex for the varyings of the pipeline that transformed it
+		FrameArray<Vector4> positions_out{};
+		FrameArray<float> varyings_out{};
+		int varyingCount{};
 
-		std::vector<Vertex_Out> vertices_out{};
+		//Copied from the scene snapshot at the start of every frame, the default cull mode is what the scene starts with
+		CullMode cullMode{ CullMode::Back };
 		Matrix worldMatrix{};
 
-		void RotateY(float angle)
+		BoundingBox boundingBox{};
+		BoundingSphere boundingSphere{};
+
+		//Only triangle lists are split, a strip has no meshlets and is always processed as a whole
+		std::vector<Meshlet> meshlets{};
+		std::vector<uint32_t> meshletVertices{};
+
+		//Cuts the index buffer in order into meshlets, a new one starts when the next triangle would go over either limit
+		void BuildMeshlets()
 		{
-			worldMatrix = Matrix::CreateRotationY(angle * TO_RADIANS) * worldMatrix;
+			meshlets.clear();
+			meshletVertices.clear();
+
+			if (primitiveTopology != PrimitiveTopology::TriangleList) return;
+
+			//Meshlet that last counted each vertex, so shared vertices are only counted once per meshlet
+			//Meshlets are built once at load time, this scratch never exists during a frame
+			std::vector<uint32_t> vertexMeshlet(vertices.size(), UINT32_MAX);
+
+			const uint32_t nrOfTriangles{ static_cast<uint32_t>(indices.size() / 3) };
+
+			Meshlet meshlet{};
+
+			for (uint32_t triangleIndex{}; triangleIndex < nrOfTriangles; ++triangleIndex)
+			{
+				const uint32_t* pTriangle{ indices.data() + triangleIndex * 3 };
+
+				//A triangle can use the same vertex twice, it is still only one new vertex
+				uint32_t nrOfNewVertices{};
+
+				for (uint32_t corner{}; corner < 3; ++corner)
+				{
+					const bool isRepeated{ (corner > 0 && pTriangle[corner] == pTriangle[0]) || (corner > 1 && pTriangle[corner] == pTriangle[1]) };
+
+					if (vertexMeshlet[pTriangle[corner]] != meshlets.size() && !isRepeated) ++nrOfNewVertices;
+				}
+
+				if (meshlet.nrOfTriangles == MAX_MESHLET_TRIANGLES || meshlet.nrOfVertices + nrOfNewVertices > MAX_MESHLET_VERTICES)
+				{
+					FinishMeshlet(meshlet);
+					meshlets.emplace_back(meshlet);
+
+					meshlet = Meshlet{ triangleIndex, 0, static_cast<uint32_t>(meshletVertices.size()) };
+				}
+
+				for (uint32_t corner{}; corner < 3; ++corner)
+				{
+					if (vertexMeshlet[pTriangle[corner]] != meshlets.size())
+					{
+						vertexMeshlet[pTriangle[corner]] = static_cast<uint32_t>(meshlets.size());
+						meshletVertices.emplace_back(pTriangle[corner]);
+						++meshlet.nrOfVertices;
+					}
+				}
+
+				++meshlet.nrOfTriangles;
+			}
+
+			if (meshlet.nrOfTriangles > 0)
+			{
+				FinishMeshlet(meshlet);
+				meshlets.emplace_back(meshlet);
+			}
 		}
 
+		//Bounding sphere and normal cone of the triangles of a meshlet
+		void FinishMeshlet(Meshlet& meshlet) const
+		{
+			const uint32_t* pIndices{ indices.data() + meshlet.firstTriangle * 3 };
+			const uint32_t nrOfIndices{ meshlet.nrOfTriangles * 3 };
+
+			//Sphere around the center of the box of the vertices, like the one of the whole mesh
+			BoundingBox box{ vertices[pIndices[0]].position, vertices[pIndices[0]].position };
+
+			for (uint32_t index{}; index < nrOfIndices; ++index)
+			{
+				const Vector3& position{ vertices[pIndices[index]].position };
+
+				for (int axis{}; axis < 3; ++axis)
+				{
+					box.min[axis] = std::min(box.min[axis], position[axis]);
+					box.max[axis] = std::max(box.max[axis], position[axis]);
+				}
+			}
+
+			meshlet.boundingSphere.center = (box.min + box.max) * 0.5f;
+			meshlet.boundingSphere.radius = 0.f;
+
+			for (uint32_t index{}; index < nrOfIndices; ++index)
+			{
+				meshlet.boundingSphere.radius = std::max(meshlet.boundingSphere.radius, (vertices[pIndices[index]].position - meshlet.boundingSphere.center).Magnitude());
+			}
+
+			//Face normals point out of the side the rasterizer calls front facing, degenerate triangles don't point anywhere and are left out
+			std::vector<Vector3> normals{};
+			normals.reserve(meshlet.nrOfTriangles);
+
+			Vector3 normalSum{};
+
+			for (uint32_t index{}; index < nrOfIndices; index += 3)
+			{
+				const Vector3& position0{ vertices[pIndices[index]].position };
+				const Vector3& position1{ vertices[pIndices[index + 1]].position };
+				const Vector3& position2{ vertices[pIndices[index + 2]].position };
+
+				Vector3 normal{ Vector3::Cross(position1 - position0, position2 - position0) };
+				if (normal.Normalize() <= 0.f) continue;
+
+				normals.emplace_back(normal);
+				normalSum += normal;
+			}
+
+			meshlet.coneCos = -1.f;
+			meshlet.coneSin = 0.f;
+
+			if (normals.empty() || normalSum.Normalize() <= 0.f) return;
+
+			float minCos{ 1.f };
+
+			for (const Vector3& normal : normals)
+			{
+				minCos = std::min(minCos, Vector3::Dot(normal, normalSum));
+			}
+
+			meshlet.coneAxis = normalSum;
+			meshlet.coneCos = minCos;
+			meshlet.coneSin = std::sqrt(std::max(0.f, 1.f - minCos * minCos));
+		}
+
+		//Box around every vertex, and a sphere around the center of that box through its farthest vertex
+		void ComputeBounds()
+		{
+			if (vertices.empty()) return;
+
+			boundingBox = BoundingBox{ vertices[0].position, vertices[0].position };
+
+			for (const Vertex& vertex : vertices)
+			{
+				for (int axis{}; axis < 3; ++axis)
+				{
+					boundingBox.min[axis] = std::min(boundingBox.min[axis], vertex.position[axis]);
+					boundingBox.max[axis] = std::max(boundingBox.max[axis], vertex.position[axis]);
+				}
+			}
+
+			boundingSphere.center = (boundingBox.min + boundingBox.max) * 0.5f;
+			boundingSphere.radius = 0.f;
+
+			for (const Vertex& vertex : vertices)
+			{
+				boundingSphere.radius = std::max(boundingSphere.radius, (vertex.position - boundingSphere.center).Magnitude());
+			}
+		}
+
+		//Where the mesh is with respect to a world space frustum under its current world matrix
+		//The sphere is the cheap test, the box only decides the meshes the sphere leaves intersecting
+		FrustumTest TestFrustum(const Frustum& frustum) const
+		{
+			const Vector3 axisX{ worldMatrix.GetAxisX() };
+			const Vector3 axisY{ worldMatrix.GetAxisY() };
+			const Vector3 axisZ{ worldMatrix.GetAxisZ() };
+
+			const float maxScale{ std::max(axisX.Magnitude(), std::max(axisY.Magnitude(), axisZ.Magnitude())) };
+			const FrustumTest sphereTest{ frustum.Test(BoundingSphere{ worldMatrix.TransformPoint(boundingSphere.center), boundingSphere.radius * maxScale }) };
+
+			if (sphereTest != FrustumTest::Intersecting) return sphereTest;
+
+			//World axis aligned box around the transformed box, every world axis gets the absolute contribution of each local axis
+			const Vector3 center{ worldMatrix.TransformPoint((boundingBox.min + boundingBox.max) * 0.5f) };
+			const Vector3 halfSize{ (boundingBox.max - boundingBox.min) * 0.5f };
+
+			Vector3 extents{};
+
+			for (int axis{}; axis < 3; ++axis)
+			{
+				extents[axis] = std::abs(axisX[axis]) * halfSize.x + std::abs(axisY[axis]) * halfSize.y + std::abs(axisZ[axis]) * halfSize.z;
+			}
+
+			return frustum.Test(center, extents);
+		}
+
+		//Orders the vertices by their first use in the index buffer and drops the ones no triangle uses
+		//Vertex processing then only transforms vertices that are referenced, in the order triangle setup reads them
+		void CompactVertices()
+		{
+			std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+
+			std::vector<Vertex> compactVertices{};
+			compactVertices.reserve(vertices.size());
+
+			for (uint32_t& index : indices)
+			{
+				if (remap[index] == UINT32_MAX)
+				{
+					remap[index] = static_cast<uint32_t>(compactVertices.size());
+					compactVertices.emplace_back(vertices[index]);
+				}
+
+				index = remap[index];
+			}
+
+			vertices.swap(compactVertices);
+		}
+
+		void BuildPositionStreams(const size_t laneCount)
+		{
+			const size_t paddedSize{ (vertices.size() + laneCount - 1) / laneCount * laneCount };
+
+			positionsX.assign(paddedSize, 0.f);
+			positionsY.assign(paddedSize, 0.f);
+			positionsZ.assign(paddedSize, 0.f);
+
+			for (size_t vertexIndex{}; vertexIndex < vertices.size(); ++vertexIndex)
+			{
+				positionsX[vertexIndex] = vertices[vertexIndex].position.x;
+				positionsY[vertexIndex] = vertices[vertexIndex].position.y;
+				positionsZ[vertexIndex] = vertices[vertexIndex].position.z;
+			}
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "FrameArena.h"
+
+using namespace dae;
+
+FrameArena::FrameArena(size_t capacity)
+{
+	if (capacity == 0) return;
+
+	m_Capacity = (capacity + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+	m_pBlock = AllocateBlock(m_Capacity);
+}
+
+FrameArena::~FrameArena()
+{
+	for (std::byte* pBlock : m_OverflowBlocks)
+	{
+		FreeBlock(pBlock);
+	}
+
+	FreeBlock(m_pBlock);
+}
+
+void FrameArena::Reset()
+{
+	m_PeakSize = GetPeakSize();
+
+	//The last frame did not fit, give the next one a single block big enough for the worst frame so far
+	if (!m_OverflowBlocks.empty())
+	{
+		for (std::byte* pBlock : m_OverflowBlocks)
+		{
+			FreeBlock(pBlock);
+		}
+
+		m_OverflowBlocks.clear();
+
+		FreeBlock(m_pBlock);
+
+		m_Capacity = m_PeakSize;
+		m_pBlock = AllocateBlock(m_Capacity);
+	}
+
+	m_Offset = 0;
+	m_OverflowSize = 0;
+}
+
+void* FrameArena::AllocateBytes(size_t size)
+{
+	//Every allocation starts on its own cache line, so data written by different threads never shares one
+	size = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+
+	if (m_Offset + size <= m_Capacity)
+	{
+		void* pData{ m_pBlock + m_Offset };
+		m_Offset += size;
+
+		return pData;
+	}
+
+	std::byte* pBlock{ AllocateBlock(size) };
+
+	m_OverflowBlocks.emplace_back(pBlock);
+	m_OverflowSize += size;
+
+	return pBlock;
+}
+
+std::byte* FrameArena::AllocateBlock(size_t size)
+{
+	return static_cast<std::byte*>(::operator new(size, std::align_val_t{ CACHE_LINE_SIZE }));
+}
+
+void FrameArena::FreeBlock(std::byte* pBlock)
+{
+	if (pBlock) ::operator delete(pBlock, std::align_val_t{ CACHE_LINE_SIZE });
+}
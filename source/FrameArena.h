@@ -0,0 +1,145 @@
+#pragma once
+
+//Standard includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dae
+{
+	//Bump allocator for everything that only lives for one frame, all of it is released at once by Reset
+	//Allocations that don't fit go to extra blocks, the next Reset grows the main block to the peak so steady state frames never touch the heap
+	class FrameArena final
+	{
+	public:
+		FrameArena(size_t capacity = 0);
+		~FrameArena();
+
+		FrameArena(const FrameArena&) = delete;
+		FrameArena(FrameArena&&) noexcept = delete;
+		FrameArena& operator=(const FrameArena&) = delete;
+		FrameArena& operator=(FrameArena&&) noexcept = delete;
+
+		//Starts a new frame, every pointer handed out before is invalid after this
+		void Reset();
+
+		//Uninitialized room for count objects, aligned to a cache line
+		//Nothing is ever destructed, so only trivially destructible types are allowed
+		template<typename T>
+		T* Allocate(size_t count)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "The arena never runs destructors");
+			static_assert(alignof(T) <= CACHE_LINE_SIZE);
+
+			return static_cast<T*>(AllocateBytes(count * sizeof(T)));
+		}
+
+		//Most bytes any frame so far needed
+		size_t GetPeakSize() const { return std::max(m_PeakSize, GetUsedSize()); }
+		size_t GetCapacity() const { return m_Capacity; }
+
+		static constexpr size_t CACHE_LINE_SIZE{ 64 };
+
+	private:
+		std::byte* m_pBlock{ nullptr };
+		size_t m_Capacity{};
+		size_t m_Offset{};
+
+		std::vector<std::byte*> m_OverflowBlocks{};
+		size_t m_OverflowSize{};
+
+		size_t m_PeakSize{};
+
+		void* AllocateBytes(size_t size);
+		size_t GetUsedSize() const { return m_Offset + m_OverflowSize; }
+
+		static std::byte* AllocateBlock(size_t size);
+		static void FreeBlock(std::byte* pBlock);
+	};
+
+	//Growable array in a FrameArena, covers the part of std::vector the renderer uses for its per-frame data
+	//Growing copies into a new, larger allocation, the old one is only given back when the arena is reset
+	template<typename T>
+	class FrameArray final
+	{
+	public:
+		static_assert(std::is_trivially_copyable_v<T>, "Elements are moved around with plain copies");
+
+		FrameArray() = default;
+
+		FrameArray(FrameArena& arena, size_t capacity) :
+			m_pArena{ &arena },
+			m_pData{ arena.Allocate<T>(std::max(capacity, size_t{ 1 })) },
+			m_Capacity{ std::max(capacity, size_t{ 1 }) }
+		{
+		}
+
+		T& operator[](size_t index) { return m_pData[index]; }
+		const T& operator[](size_t index) const { return m_pData[index]; }
+
+		T* data() { return m_pData; }
+		const T* data() const { return m_pData; }
+
+		T* begin() { return m_pData; }
+		T* end() { return m_pData + m_Size; }
+		const T* begin() const { return m_pData; }
+		const T* end() const { return m_pData + m_Size; }
+
+		T& back() { return m_pData[m_Size - 1]; }
+		const T& back() const { return m_pData[m_Size - 1]; }
+
+		size_t size() const { return m_Size; }
+		bool empty() const { return m_Size == 0; }
+
+		void clear() { m_Size = 0; }
+		void pop_back() { --m_Size; }
+
+		//New elements are value initialized, like std::vector does
+		void resize(size_t size)
+		{
+			if (size > m_Capacity) Grow(size);
+
+			for (size_t index{ m_Size }; index < size; ++index)
+			{
+				new (m_pData + index) T{};
+			}
+
+			m_Size = size;
+		}
+
+		//New elements are left uninitialized, for arrays that are written before they are read
+		void resize_for_overwrite(size_t size)
+		{
+			if (size > m_Capacity) Grow(size);
+
+			m_Size = size;
+		}
+
+		template<typename... Args>
+		T& emplace_back(Args&&... args)
+		{
+			if (m_Size == m_Capacity) Grow(m_Capacity * 2);
+
+			return *new (m_pData + m_Size++) T{ std::forward<Args>(args)... };
+		}
+
+	private:
+		FrameArena* m_pArena{ nullptr };
+		T* m_pData{ nullptr };
+		size_t m_Size{};
+		size_t m_Capacity{};
+
+		void Grow(size_t capacity)
+		{
+			T* pData{ m_pArena->Allocate<T>(capacity) };
+			std::copy_n(m_pData, m_Size, pData);
+
+			m_pData = pData;
+			m_Capacity = capacity;
+		}
+	};
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <SDL_assert.h>
+#include <SDL_pixels.h>
+#include <cstdint>
+
+#include "ColorRGB.h"
+#include "SIMD.h"
+
+//Writes shaded colors straight into the back buffer format
+//The surface format is looked at once when the packer is made, packing a pixel is a handful of inline shifts instead of a call to SDL_MapRGB
+
+namespace dae
+{
+	class PixelPacker final
+	{
+	public:
+		PixelPacker() = default;
+
+		//Only 32 bit formats, the renderer writes whole uint32_t pixels
+		explicit PixelPacker(const SDL_PixelFormat* pFormat) :
+			m_RedShift{ pFormat->Rshift },
+			m_GreenShift{ pFormat->Gshift },
+			m_BlueShift{ pFormat->Bshift },
+			m_RedLoss{ pFormat->Rloss },
+			m_GreenLoss{ pFormat->Gloss },
+			m_BlueLoss{ pFormat->Bloss },
+			m_RedMask{ pFormat->Rmask },
+			m_GreenMask{ pFormat->Gmask },
+			m_BlueMask{ pFormat->Bmask },
+			m_AlphaMask{ pFormat->Amask }
+		{
+			SDL_assert(pFormat->BytesPerPixel == 4);
+		}
+
+		//SDL_MapRGB for a 32 bit surface: ((channel >> loss) << shift) | Amask
+		uint32_t Pack(uint8_t red, uint8_t green, uint8_t blue) const
+		{
+			return (uint32_t(red >> m_RedLoss) << m_RedShift)
+				| (uint32_t(green >> m_GreenLoss) << m_GreenShift)
+				| (uint32_t(blue >> m_BlueLoss) << m_BlueShift)
+				| m_AlphaMask;
+		}
+
+		//MaxToOne, scale to [0, 255] and pack, the same steps the renderer used to take before SDL_MapRGB
+		uint32_t Pack(ColorRGB color) const
+		{
+			color.MaxToOne();
+
+			return Pack(static_cast<uint8_t>(color.r * 255), static_cast<uint8_t>(color.g * 255), static_cast<uint8_t>(color.b * 255));
+		}
+
+		//Same steps for a whole group of pixels
+		SIMD::Ints Pack(SIMD::Floats red, SIMD::Floats green, SIMD::Floats blue) const
+		{
+			using namespace SIMD;
+
+			const Floats one{ Set(1.f) };
+
+			//ColorRGB::MaxToOne
+			const Floats maxValue{ Max(red, Max(green, blue)) };
+			const Floats isOverOne{ Greater(maxValue, one) };
+
+			red = Select(red, Div(red, maxValue), isOverOne);
+			green = Select(green, Div(green, maxValue), isOverOne);
+			blue = Select(blue, Div(blue, maxValue), isOverOne);
+
+			const Floats maxChannel{ Set(255.f) };
+
+			return Or(Or(Or(
+				ShiftLeft(ShiftRight(TruncateToInt(Mul(red, maxChannel)), m_RedLoss), m_RedShift),
+				ShiftLeft(ShiftRight(TruncateToInt(Mul(green, maxChannel)), m_GreenLoss), m_GreenShift)),
+				ShiftLeft(ShiftRight(TruncateToInt(Mul(blue, maxChannel)), m_BlueLoss), m_BlueShift)),
+				Set(m_AlphaMask));
+		}
+
+		//Channels of a packed pixel, still at the precision of the format
+		uint32_t GetRed(uint32_t pixel) const { return (pixel & m_RedMask) >> m_RedShift; }
+		uint32_t GetGreen(uint32_t pixel) const { return (pixel & m_GreenMask) >> m_GreenShift; }
+		uint32_t GetBlue(uint32_t pixel) const { return (pixel & m_BlueMask) >> m_BlueShift; }
+
+		//Packs channels that are already at the precision of the format
+		uint32_t PackRaw(uint32_t red, uint32_t green, uint32_t blue) const
+		{
+			return (red << m_RedShift) | (green << m_GreenShift) | (blue << m_BlueShift) | m_AlphaMask;
+		}
+
+	private:
+		int m_RedShift{}, m_GreenShift{}, m_BlueShift{};
+		int m_RedLoss{}, m_GreenLoss{}, m_BlueLoss{};
+
+		uint32_t m_RedMask{}, m_GreenMask{}, m_BlueMask{};
+		uint32_t m_AlphaMask{};
+	};
+}
@@ -4,15 +4,19 @@
 
 //Project includes
 #include "Renderer.h"
+#include "AllocationCounter.h"
 #include "Math.h"
 #include "Matrix.h"
 #include "Texture.h"
 #include "Utils.h"
+#include "SIMD.h"
+#include "Shaders.h"
 #include <iostream>
 #include <thread>
-#include <ppl.h>
-#include <future>
 #include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
 
 using namespace dae;
 
@@ -27,16 +31,25 @@ Renderer::Renderer(SDL_Window* pWindow) :
 
 	//Create Buffers
 	m_pFrontBuffer = SDL_GetWindowSurface(pWindow);
-	m_pBackBuffer = SDL_CreateRGBSurface(0, m_Width, m_Height, 32, 0, 0, 0, 0);
+	for (SDL_Surface*& pBackBuffer : m_pBackBuffers)
+	{
+		pBackBuffer = SDL_CreateRGBSurface(0, m_Width, m_Height, 32, 0, 0, 0, 0);
+	}
+
+	//Every back buffer is created the same way, so they share one format
+	m_pBackBuffer = m_pBackBuffers[m_BackBufferIndex];
 	m_pBackBufferPixels = static_cast<uint32_t*>(m_pBackBuffer->pixels);
+	m_PixelPacker = PixelPacker{ m_pBackBuffer->format };
+	m_BackgroundColor = m_PixelPacker.Pack(100, 100, 100);
 
 	m_pDepthBufferPixels = new float[m_Width * m_Height];
+	m_pVisibilityBufferPixels = new uint32_t[m_Width * m_Height];
 
 	m_AspectRatio = static_cast<float>(m_Width) / m_Height;
 	//Initialize Camera
 	m_Camera.Initialize(m_AspectRatio,60.f, { .0f,.0f,-10.f });
 
-	m_NrOfPixels = m_Width * m_Height;
+	InitializeTiles();
 
 	if (m_IsCamLocked) SDL_SetRelativeMouseMode(SDL_TRUE);
 	else SDL_SetRelativeMouseMode(SDL_FALSE);
@@ -45,13 +58,57 @@ Renderer::Renderer(SDL_Window* pWindow) :
 	//Utils::ParseOBJ("Resources/vehicle.obj", m_Meshes_World[1].vertices, m_Meshes_World[1].indices);
 
 
-	m_Meshes_World[0].worldMatrix = Matrix::CreateScale(Vector3{ 0.5f, 0.5f, 0.5f });
+	for (Mesh& mesh : m_Meshes_World)
+	{
+		mesh.CompactVertices();
+		mesh.BuildPositionStreams(SIMD::LANE_COUNT);
+		mesh.ComputeBounds();
+		mesh.BuildMeshlets();
+
+		m_Scene.worldMatrices.emplace_back();
+		m_Scene.cullModes.emplace_back(mesh.cullMode);
+	}
+
+	m_Scene.worldMatrices[0] = Matrix::CreateScale(Vector3{ 0.5f, 0.5f, 0.5f });
+
+	//Every triangle binned in the visibility pass needs its own id, also when clipping splits all of them
+	m_IsVisibilityBufferSupported = m_Meshes_World.size() <= m_MaxVisibilityMeshes;
+
+	for (const Mesh& mesh : m_Meshes_World)
+	{
+		const size_t nrOfTriangles{ mesh.primitiveTopology == PrimitiveTopology::TriangleList ? mesh.indices.size() / 3 : mesh.indices.size() };
+		if (nrOfTriangles * m_MaxClippedTriangles > m_MaxVisibilityTriangles) m_IsVisibilityBufferSupported = false;
+	}
+
+	if (!m_IsVisibilityBufferSupported) std::cout << "Scene is too big for visibility ids, the visibility buffer falls back to the forward path" << std::endl;
+
+	//A Render before the first Update still finds a complete scene
+	PublishScene();
 
+	m_PresentThread = std::thread{ &Renderer::PresentLoop, this };
 }
 
 Renderer::~Renderer()
 {
+	//Frames still in the queue are presented before the thread stops
+	{
+		std::lock_guard lock{ m_PresentMutex };
+		m_IsStoppingPresent = true;
+	}
+
+	m_PresentCondition.notify_all();
+	m_PresentThread.join();
+
+	for (SDL_Surface* pBackBuffer : m_pBackBuffers)
+	{
+		SDL_FreeSurface(pBackBuffer);
+	}
+
 	delete[] m_pDepthBufferPixels;
+	delete[] m_pVisibilityBufferPixels;
+
+	delete[] m_pSampleDepthPixels;
+	delete[] m_pSampleColorPixels;
 
 	delete m_pTexture;
 }
@@ -60,221 +117,1716 @@ void Renderer::Update(Timer* pTimer)
 {
 	m_Camera.Update(pTimer);
 
-	m_Meshes_World[0].RotateY(m_RotateSpeed * pTimer->GetElapsed());
+	m_Scene.worldMatrices[0] = Matrix::CreateRotationY(m_RotateSpeed * pTimer->GetElapsed() * TO_RADIANS) * m_Scene.worldMatrices[0];
+
+	PublishScene();
+}
+
+void Renderer::PublishScene()
+{
+	m_Scene.viewMatrix = m_Camera.viewMatrix;
+	m_Scene.projectionMatrix = m_Camera.projectionMatrix;
+	m_Scene.frustum = m_Camera.frustum;
+	m_Scene.cameraOrigin = m_Camera.origin;
+
+	//The buffer handed back was published before, its vectors already have the right size so this copy doesn't allocate
+	m_SceneSnapshots.GetWriteBuffer() = m_Scene;
+	m_SceneSnapshots.Publish();
+}
+
+void Renderer::ApplyScene()
+{
+	const SceneSnapshot& scene{ m_SceneSnapshots.Acquire() };
+
+	m_Settings = scene.settings;
+	m_ViewMatrix = scene.viewMatrix;
+	m_ProjectionMatrix = scene.projectionMatrix;
+	m_Frustum = scene.frustum;
+	m_CameraOrigin = scene.cameraOrigin;
+
+	for (size_t meshIndex{}; meshIndex < m_Meshes_World.size(); ++meshIndex)
+	{
+		m_Meshes_World[meshIndex].worldMatrix = scene.worldMatrices[meshIndex];
+		m_Meshes_World[meshIndex].cullMode = scene.cullModes[meshIndex];
+	}
 }
 
 void Renderer::Render()
 {
+	AllocationCounter::TrackCurrentThread();
+	const uint64_t nrOfAllocations{ AllocationCounter::GetNrOfAllocations() };
+
+	ApplyScene();
+	AcquireBackBuffer();
+
+	if (m_Settings.isUsingMultisampling) AllocateSampleBuffers();
+
+	ClearHierarchicalDepth();
 
-	ClearDepthBuffer();
-	ClearBackGround();
+	m_FrameArena.Reset();
+
+	for (Tile& tile : m_Tiles)
+	{
+		tile.isCleared = false;
+		tile.triangleIndices = FrameArray<uint32_t>{ m_FrameArena, m_InitialBinCapacity };
+	}
 
 	//@START
 	//Lock BackBuffer
 	SDL_LockSurface(m_pBackBuffer);
 
-	for (Mesh& mesh : m_Meshes_World)
+	switch (m_Settings.shadingMode)
+	{
+		case ShadingMode::Texture: RenderFrame<TexturePipeline>(); break;
+		case ShadingMode::Depth: RenderFrame<DepthPipeline>(); break;
+		case ShadingMode::Normal: RenderFrame<NormalPipeline>(); break;
+	}
+
+	FillUntouchedTiles();
+
+	//@END 
+	SDL_UnlockSurface(m_pBackBuffer);
+
+	QueuePresent();
+
+	m_NrOfFrameAllocations = AllocationCounter::GetNrOfAllocations() - nrOfAllocations;
+}
+
+void Renderer::AcquireBackBuffer()
+{
+	m_BackBufferIndex = (m_BackBufferIndex + 1) % m_NrOfBackBuffers;
+
+	//Wait until the frame that last used this buffer is on screen
+	{
+		std::unique_lock lock{ m_PresentMutex };
+		m_PresentCondition.wait(lock, [this] { return !m_IsBackBufferPresenting[m_BackBufferIndex]; });
+	}
+
+	m_pBackBuffer = m_pBackBuffers[m_BackBufferIndex];
+	m_pBackBufferPixels = static_cast<uint32_t*>(m_pBackBuffer->pixels);
+}
+
+void Renderer::AllocateSampleBuffers()
+{
+	//Switching multisampling off again keeps them, so toggling it back and forth does not reallocate every time
+	if (m_pSampleDepthPixels) return;
+
+	m_pSampleDepthPixels = new float[m_Width * m_Height * NR_OF_SAMPLES];
+	m_pSampleColorPixels = new uint32_t[m_Width * m_Height * NR_OF_SAMPLES];
+}
+
+void Renderer::QueuePresent()
+{
+	{
+		std::lock_guard lock{ m_PresentMutex };
+		m_IsBackBufferPresenting[m_BackBufferIndex] = true;
+		m_PresentQueue[(m_PresentQueueFront + m_NrOfQueuedPresents++) % m_NrOfBackBuffers] = m_BackBufferIndex;
+	}
+
+	m_PresentCondition.notify_all();
+}
+
+void Renderer::PresentLoop()
+{
+	while (true)
 	{
-		VertexTransformationFunction(mesh);
+		int backBufferIndex{};
 
-		switch (mesh.primitiveTopology)
 		{
-			case PrimitiveTopology::TriangleList:
-			{
+			std::unique_lock lock{ m_PresentMutex };
+			m_PresentCondition.wait(lock, [this] { return m_IsStoppingPresent || m_NrOfQueuedPresents > 0; });
 
-				for (size_t vertexIndex{}; vertexIndex < mesh.indices.size(); vertexIndex += 3)
-				{
-					RenderTriangle(vertexIndex, mesh, false);
-				}
+			if (m_NrOfQueuedPresents == 0) return;
 
-			}
-			break;
-				
-			case PrimitiveTopology::TriangleStrip:
-			{
-				for (size_t vertexIndex{}; vertexIndex < mesh.indices.size() - 2; ++vertexIndex)
-				{
-					RenderTriangle(vertexIndex, mesh, vertexIndex % 2);
-				}
-			}
-			break;
+			backBufferIndex = m_PresentQueue[m_PresentQueueFront];
+			m_PresentQueueFront = (m_PresentQueueFront + 1) % m_NrOfBackBuffers;
+			--m_NrOfQueuedPresents;
+		}
+
+		//Taking the frame off the queue under the mutex also makes every pixel the render thread wrote visible here
+		SDL_BlitSurface(m_pBackBuffers[backBufferIndex], 0, m_pFrontBuffer, 0);
+		SDL_UpdateWindowSurface(m_pWindow);
 
+		{
+			std::lock_guard lock{ m_PresentMutex };
+			m_IsBackBufferPresenting[backBufferIndex] = false;
 		}
+
+		m_PresentCondition.notify_all();
 	}
+}
 
-	//@END 
-	//Update SDL Surface
-	SDL_UnlockSurface(m_pBackBuffer);
-	SDL_BlitSurface(m_pBackBuffer, 0, m_pFrontBuffer, 0);
-	SDL_UpdateWindowSurface(m_pWindow);
+template<typename Pipeline>
+void Renderer::RenderFrame()
+{
+	if (m_Settings.isUsingMultisampling)
+	{
+		m_RenderPass = RenderPass::Multisample;
+		RenderMeshes<Pipeline>();
+
+		m_ThreadPool.ParallelFor(static_cast<uint32_t>(m_Height), [&](uint32_t py)
+		{
+			ResolveSamplesRow(static_cast<int>(py));
+		});
+
+		return;
+	}
+
+	const bool isUsingVisibilityBuffer{ m_Settings.isUsingVisibilityBuffer && m_IsVisibilityBufferSupported };
+
+	if (isUsingVisibilityBuffer)
+	{
+		m_RenderPass = RenderPass::Visibility;
+		RenderMeshes<Pipeline>();
+
+		m_ThreadPool.ParallelFor(static_cast<uint32_t>(m_Height), [&](uint32_t py)
+		{
+			ResolveVisibilityRow<Pipeline>(static_cast<int>(py));
+		});
+	}
+	else
+	{
+		m_RenderPass = m_Settings.isUsingDepthPrePass ? RenderPass::DepthOnly : RenderPass::Combined;
+		RenderMeshes<Pipeline>();
+	}
 
+	if (m_Settings.isUsingDepthPrePass && !isUsingVisibilityBuffer)
+	{
+		//The bins only ever hold the last mesh, so the shading pass transforms and bins every mesh again
+		m_RenderPass = RenderPass::Shade;
+		RenderMeshes<Pipeline>();
+	}
 }
 
-void Renderer::VertexTransformationFunction(Mesh& mesh)
+template<typename Pipeline>
+void Renderer::RenderMeshes()
 {
+	m_NrOfZeroAreaCulled = 0;
+	m_NrOfBackFacesCulled = 0;
+	m_NrOfFrontFacesCulled = 0;
+	m_NrOfMeshesCulled = 0;
+	m_NrOfMeshletsCulled = 0;
+	m_NrOfMeshletsFacingAway = 0;
+
+	m_VisibilityMeshes.resize(m_Meshes_World.size());
+
+	for (m_MeshIndex = 0; m_MeshIndex < m_Meshes_World.size(); ++m_MeshIndex)
+	{
+		Mesh& mesh{ m_Meshes_World[m_MeshIndex] };
+
+		//Nothing of a mesh outside the frustum can reach the screen, it isn't transformed or binned at all
+		const FrustumTest frustumTest{ mesh.TestFrustum(m_Frustum) };
+
+		if (frustumTest == FrustumTest::Outside)
+		{
+			++m_NrOfMeshesCulled;
+			m_VisibilityMeshes[m_MeshIndex] = VisibilityMesh{};
+			continue;
+		}
+
+		m_IsInsideFrustum = frustumTest == FrustumTest::Inside;
+
+		CullMeshlets(mesh, m_IsInsideFrustum);
+
+		if (!mesh.meshlets.empty() && m_VisibleMeshlets.empty())
+		{
+			m_VisibilityMeshes[m_MeshIndex] = VisibilityMesh{};
+			continue;
+		}
+
+		VertexTransformationFunction<typename Pipeline::VertexShader>(mesh);
+
+		BinTriangles(mesh);
 
-	m_Vertices_ScreenSpace.clear();
+		m_ThreadPool.ParallelFor(static_cast<uint32_t>(m_Tiles.size()), [&](uint32_t tileIndex)
+		{
+			RenderTile<Pipeline>(m_Tiles[tileIndex], mesh);
+		});
+
+		if (m_RenderPass == RenderPass::Visibility)
+		{
+			//Every mesh gets new arrays from the frame arena, so keeping them is only a copy of the handles
+			m_VisibilityMeshes[m_MeshIndex].triangles = m_Triangles;
+			m_VisibilityMeshes[m_MeshIndex].verticesScreenSpace = m_Vertices_ScreenSpace;
+		}
+	}
+}
 
-	mesh.vertices_out.clear();
+template<typename Pipeline>
+void Renderer::ResolveVisibilityRow(const int py)
+{
+	uint32_t setupId{ m_EmptyVisibilityId };
+	const Tile* pSetupTile{ nullptr };
 
-	const Matrix worldViewProjectionMatrix{ mesh.worldMatrix * m_Camera.viewMatrix * m_Camera.projectionMatrix };
+	TriangleSetup setup{};
+	AttributeRow row{};
 
-	for (const Vertex& vertex : mesh.vertices)
+	for (int px{}; px < m_Width; ++px)
 	{
+		//The setup is clamped to the tile exactly like during rasterization, so the weights come out bit for bit the same
+		const Tile& tile{ m_Tiles[px / m_TileSize + (py / m_TileSize) * m_NrOfTilesX] };
 
-		Vertex_Out temp
+		//Nothing was drawn to this tile, its visibility ids are left over from an earlier frame
+		if (!tile.isCleared)
 		{
-			Vector4 { worldViewProjectionMatrix.TransformPoint({vertex.position, 1.f})},
-			vertex.color,
-			vertex.uv,
-			vertex.normal,
-			vertex.tangent
-		};
+			px = tile.maxX - 1;
+			continue;
+		}
+
+		const int pixelIndex{ px + py * m_Width };
+		const uint32_t visibilityId{ m_pVisibilityBufferPixels[pixelIndex] };
+
+		if (visibilityId == m_EmptyVisibilityId) continue;
+
+		if (visibilityId != setupId || &tile != pSetupTile)
+		{
+			const uint32_t meshIndex{ visibilityId >> m_TriangleIdBits };
+			const VisibilityMesh& visibilityMesh{ m_VisibilityMeshes[meshIndex] };
+			const Triangle& triangle{ visibilityMesh.triangles[visibilityId & m_TriangleIdMask] };
+
+			setup = {};
+			ClampToTile(setup, triangle, tile);
+			SetupInterpolation<typename Pipeline::Varyings>(setup, triangle, m_Meshes_World[meshIndex], visibilityMesh.verticesScreenSpace);
 
-		temp.position.x /= temp.position.w;
-		temp.position.y /= temp.position.w;
-		temp.position.z /= temp.position.w;
+			row = GetAttributeRow<typename Pipeline::Varyings>(setup, py);
+
+			setupId = visibilityId;
+			pSetupTile = &tile;
+		}
 
-		mesh.vertices_out.emplace_back(temp);
+		//The depth buffer holds the depth of exactly this triangle at this pixel, no need to interpolate it again
+		m_pBackBufferPixels[pixelIndex] = ShadeColor<Pipeline>(setup, row, static_cast<float>(px - setup.minX), m_pDepthBufferPixels[pixelIndex]);
 	}
+}
 
-	for (const Vertex_Out& vertice : mesh.vertices_out)
+void Renderer::ResolveSamplesRow(const int py)
+{
+	for (int px{}; px < m_Width; ++px)
 	{
-		Vector2 v{
-		((vertice.position.x + 1) / 2) * m_Width,
-		((1 - vertice.position.y) / 2) * m_Height};
+		//Nothing was drawn to this tile, its samples are left over from an earlier frame
+		const Tile& tile{ m_Tiles[px / m_TileSize + (py / m_TileSize) * m_NrOfTilesX] };
+
+		if (!tile.isCleared)
+		{
+			px = tile.maxX - 1;
+			continue;
+		}
+
+		const int pixelIndex{ px + py * m_Width };
+		const uint32_t* pSamples{ m_pSampleColorPixels + pixelIndex * NR_OF_SAMPLES };
+
+		uint32_t red{}, green{}, blue{};
+
+		for (int sampleIndex{}; sampleIndex < NR_OF_SAMPLES; ++sampleIndex)
+		{
+			red += m_PixelPacker.GetRed(pSamples[sampleIndex]);
+			green += m_PixelPacker.GetGreen(pSamples[sampleIndex]);
+			blue += m_PixelPacker.GetBlue(pSamples[sampleIndex]);
+		}
 
-		m_Vertices_ScreenSpace.emplace_back(v);
+		//Round to nearest
+		red = (red + NR_OF_SAMPLES / 2) / NR_OF_SAMPLES;
+		green = (green + NR_OF_SAMPLES / 2) / NR_OF_SAMPLES;
+		blue = (blue + NR_OF_SAMPLES / 2) / NR_OF_SAMPLES;
+
+		m_pBackBufferPixels[pixelIndex] = m_PixelPacker.PackRaw(red, green, blue);
 	}
+}
 
+void Renderer::CycleShadingMode()
+{
+	ShadingMode& shadingMode{ m_Scene.settings.shadingMode };
+
+	switch (shadingMode)
+	{
+		case ShadingMode::Texture: shadingMode = ShadingMode::Depth; break;
+		case ShadingMode::Depth: shadingMode = ShadingMode::Normal; break;
+		case ShadingMode::Normal: shadingMode = ShadingMode::Texture; break;
+	}
 }
 
-void Renderer::RenderTriangle(const size_t index, const Mesh& mesh, const bool swapVertices)
+void Renderer::CycleCullMode()
 {
-	const size_t index0{ mesh.indices[index]};
-	const size_t index1{ mesh.indices[index + 1 + swapVertices] };
-	const size_t index2{ mesh.indices[index + 1 + !swapVertices]  };
+	for (CullMode& cullMode : m_Scene.cullModes)
+	{
+		switch (cullMode)
+		{
+			case CullMode::Back: cullMode = CullMode::Front; break;
+			case CullMode::Front: cullMode = CullMode::None; break;
+			case CullMode::None: cullMode = CullMode::Back; break;
+		}
+	}
+}
 
-	if (index0 == index1 || index1 == index2 || index0 == index2) return;
+void Renderer::PrintCullStatistics() const
+{
+	std::cout << "Culled: " << m_NrOfBackFacesCulled << " back, " << m_NrOfFrontFacesCulled << " front, "
+		<< m_NrOfZeroAreaCulled << " zero area, " << m_NrOfMeshesCulled << " meshes outside the frustum" << std::endl;
+	std::cout << "Meshlets culled: " << m_NrOfMeshletsCulled << " outside the frustum, " << m_NrOfMeshletsFacingAway << " facing away" << std::endl;
+}
 
-	const Vertex_Out vertex_OutV0{ mesh.vertices_out[index0] };
-	const Vertex_Out vertex_OutV1{ mesh.vertices_out[index1] };
-	const Vertex_Out vertex_OutV2{ mesh.vertices_out[index2] };
+void Renderer::PrintMemoryStatistics() const
+{
+	std::cout << "Frame arena: " << m_FrameArena.GetPeakSize() / 1024 << " KB peak, " << m_FrameArena.GetCapacity() / 1024 << " KB reserved" << std::endl;
 
-	if (IsOutOfFrustrum(vertex_OutV0) || IsOutOfFrustrum(vertex_OutV1) || IsOutOfFrustrum(vertex_OutV2)) return;
+	const size_t sampleBufferSize{ m_pSampleDepthPixels ? static_cast<size_t>(m_Width) * m_Height * NR_OF_SAMPLES * (sizeof(float) + sizeof(uint32_t)) : 0 };
+	std::cout << "Multisample buffers: " << sampleBufferSize / 1024 << " KB" << std::endl;
 
-	const Vector2 v0{ m_Vertices_ScreenSpace[index0] };
-	const Vector2 v1{ m_Vertices_ScreenSpace[index1] };
-	const Vector2 v2{ m_Vertices_ScreenSpace[index2] };
+	//Only frames that grow the arena past its peak or first switch to multisampling should allocate, steady state frames show 0 here
+	if constexpr (AllocationCounter::IS_ENABLED) std::cout << "Heap allocations last frame: " << m_NrOfFrameAllocations << std::endl;
+}
 
-	const Vector2 edgeV0V1{ v1 - v0 };
-	const Vector2 edgeV1V2{ v2 - v1 };
-	const Vector2 edgeV2V0{ v0 - v2 };
+template<typename VertexShader>
+void Renderer::VertexTransformationFunction(Mesh& mesh)
+{
 
-	const float invTriangleArea{ 1 / Vector2::Cross(edgeV0V1, edgeV1V2) };
+	//Clipping appends its new vertices after these, it seldom adds more than a few percent
+	const size_t nrOfVertices{ mesh.vertices.size() };
+	const size_t capacity{ nrOfVertices + nrOfVertices / 8 };
 
-	AABB boundingBox
+	m_Vertices_ScreenSpace = FrameArray<Vector2>{ m_FrameArena, capacity };
+	m_Vertices_ClipSpace = FrameArray<Vector4>{ m_FrameArena, capacity };
+	mesh.positions_out = FrameArray<Vector4>{ m_FrameArena, capacity };
+
+	constexpr int varyingCount{ VertexShader::Varyings::COUNT };
+	mesh.varyingCount = varyingCount;
+	mesh.varyings_out = FrameArray<float>{ m_FrameArena, capacity * varyingCount };
+
+	//Left uninitialized, a vertex is only ever read by the triangles of a meshlet that had it transformed
+	m_Vertices_ScreenSpace.resize_for_overwrite(nrOfVertices);
+	m_Vertices_ClipSpace.resize_for_overwrite(nrOfVertices);
+	mesh.positions_out.resize_for_overwrite(nrOfVertices);
+	mesh.varyings_out.resize_for_overwrite(nrOfVertices * varyingCount);
+
+	const Matrix worldViewProjectionMatrix{ mesh.worldMatrix * m_ViewMatrix * m_ProjectionMatrix };
+
+	//Every chunk writes only its own range of the output arrays, vertices of culled meshlets are never written or read
+	const FrameArray<VertexRange> chunks{ GetVertexChunks(mesh) };
+
+	m_ThreadPool.ParallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t chunkIndex)
 	{
-		boundingBox.minAABB = Vector2::Min(v0, Vector2::Min(v1, v2)),
-		boundingBox.maxAABB = Vector2::Max(v0, Vector2::Max(v1, v2))
-	};
+		const size_t beginIndex{ chunks[chunkIndex].beginIndex };
+		const size_t endIndex{ chunks[chunkIndex].endIndex };
 
-	boundingBox.minAABB.Clamp((float)m_Width, (float)m_Height);
-	boundingBox.maxAABB.Clamp((float)m_Width, (float)m_Height);
+		TransformPositions(mesh, worldViewProjectionMatrix, beginIndex, endIndex);
 
-	const int margin{ 1 };
+		if constexpr (varyingCount > 0)
+		{
+			for (size_t vertexIndex{ beginIndex }; vertexIndex < endIndex; ++vertexIndex)
+			{
+				VertexShader::Transform(mesh.vertices[vertexIndex], mesh.worldMatrix, mesh.varyings_out.data() + vertexIndex * varyingCount);
+			}
+		}
+	});
+}
 
-	const int minX {std::clamp(static_cast<int>(boundingBox.minAABB.x - margin),0, m_Width)};
-	const int minY {std::clamp(static_cast<int>(boundingBox.minAABB.y - margin),0, m_Height)};
- 								
-	const int maxX {std::clamp(static_cast<int>(boundingBox.maxAABB.x + margin),0, m_Width)};
-	const int maxY {std::clamp(static_cast<int>(boundingBox.maxAABB.y + margin),0, m_Height)};
+FrameArray<Renderer::VertexRange> Renderer::GetVertexChunks(const Mesh& mesh)
+{
+	static_assert(m_VertexChunkSize % SIMD::LANE_COUNT == 0);
+
+	const size_t nrOfVertices{ mesh.vertices.size() };
 
-	for (int px{ minX }; px < maxX; ++px)
+	FrameArray<VertexRange> chunks{ m_FrameArena, nrOfVertices / m_VertexChunkSize + 1 };
+
+	if (mesh.meshlets.empty())
 	{
-		for (int py{ minY }; py < maxY; ++py)
+		for (size_t beginIndex{}; beginIndex < nrOfVertices; beginIndex += m_VertexChunkSize)
 		{
+			chunks.emplace_back(VertexRange{ beginIndex, std::min(beginIndex + m_VertexChunkSize, nrOfVertices) });
+		}
 
-			const Vector2 point{ static_cast<float>(px), static_cast<float>(py) };
+		return chunks;
+	}
+
+	//Only the SIMD groups that hold a vertex of a visible meshlet are transformed
+	const size_t nrOfGroups{ (nrOfVertices + SIMD::LANE_COUNT - 1) / SIMD::LANE_COUNT };
 
-			const Vector2 pointToEdgeSide1{ point - v0};
-			float edge0{ Vector2::Cross(edgeV0V1, pointToEdgeSide1) };
-			if (edge0 < 0) continue;
+	FrameArray<uint8_t> isGroupUsed{ m_FrameArena, nrOfGroups };
+	isGroupUsed.resize(nrOfGroups);
+
+	for (const VisibleMeshlet& visibleMeshlet : m_VisibleMeshlets)
+	{
+		const Meshlet& meshlet{ mesh.meshlets[visibleMeshlet.meshletIndex] };
 
-			const Vector2 pointToEdgeSide2{ point - v1 };
-			float edge1{ Vector2::Cross(edgeV1V2, pointToEdgeSide2) };
-			if (edge1 < 0) continue;
+		for (uint32_t vertexIndex{ meshlet.firstVertex }; vertexIndex < meshlet.firstVertex + meshlet.nrOfVertices; ++vertexIndex)
+		{
+			isGroupUsed[mesh.meshletVertices[vertexIndex] / SIMD::LANE_COUNT] = true;
+		}
+	}
 
-			const Vector2 pointToEdgeSide3{ point - v2 };
-			float edge2{ Vector2::Cross(edgeV2V0, pointToEdgeSide3) };
-			if (edge2 < 0) continue;
+	//Every run of used groups becomes chunks of at most m_VertexChunkSize vertices
+	for (size_t groupIndex{}; groupIndex < nrOfGroups;)
+	{
+		if (!isGroupUsed[groupIndex])
+		{
+			++groupIndex;
+			continue;
+		}
 
-			const float weightV0 = edge1 * invTriangleArea;
-			const float weightV1 = edge2 * invTriangleArea;
-			const float weightV2 = edge0 * invTriangleArea;
+		size_t endGroupIndex{ groupIndex + 1 };
 
+		while (endGroupIndex < nrOfGroups && isGroupUsed[endGroupIndex] && (endGroupIndex - groupIndex) * SIMD::LANE_COUNT < m_VertexChunkSize)
+		{
+			++endGroupIndex;
+		}
 
-			float depthV0{ vertex_OutV0.position.z };
-			float depthV1{ vertex_OutV1.position.z };
-			float depthV2{ vertex_OutV2.position.z };
+		chunks.emplace_back(VertexRange{ groupIndex * SIMD::LANE_COUNT, std::min(endGroupIndex * SIMD::LANE_COUNT, nrOfVertices) });
+		groupIndex = endGroupIndex;
+	}
 
-			const float interpolateDepthZ{ 1 / ( weightV0 / depthV0 + weightV1 / depthV1 + weightV2 / depthV2 ) };
+	return chunks;
+}
 
-			const int pixelIndex{ px + py * m_Width };
+void Renderer::CullMeshlets(const Mesh& mesh, const bool isMeshInsideFrustum)
+{
+	m_VisibleMeshlets = FrameArray<VisibleMeshlet>{ m_FrameArena, mesh.meshlets.size() };
 
-			if (m_pDepthBufferPixels[pixelIndex] < interpolateDepthZ /*|| interpolateDepthZ < 0 || interpolateDepthZ > 1*/) continue;
+	const float maxScale{ std::max(mesh.worldMatrix.GetAxisX().Magnitude(), std::max(mesh.worldMatrix.GetAxisY().Magnitude(), mesh.worldMatrix.GetAxisZ().Magnitude())) };
 
-			m_pDepthBufferPixels[pixelIndex] = interpolateDepthZ;
+	//Back faces are the triangles whose normal points away from the camera, for front faces the cone is turned around
+	const float coneDirection{ mesh.cullMode == CullMode::Front ? -1.f : 1.f };
 
-			ColorRGB finalColor{};
+	for (uint32_t meshletIndex{}; meshletIndex < mesh.meshlets.size(); ++meshletIndex)
+	{
+		const Meshlet& meshlet{ mesh.meshlets[meshletIndex] };
 
-			if (m_IsColoringTexture)
-			{
-				depthV0 = vertex_OutV0.position.w;
-				depthV1 = vertex_OutV1.position.w;
-				depthV2 = vertex_OutV2.position.w;
+		const Vector3 center{ mesh.worldMatrix.TransformPoint(meshlet.boundingSphere.center) };
+		const float radius{ meshlet.boundingSphere.radius * maxScale };
 
-				const float interpolateDepthW{ 1 / (weightV0 / depthV0 + weightV1 / depthV1 + weightV2 / depthV2) };
+		FrustumTest frustumTest{ FrustumTest::Inside };
 
-				const Vector2 uvPixel
-				{
-					(CalcUVComponent(weightV0, depthV0, index0, mesh)
-					+ CalcUVComponent(weightV1, depthV1, index1, mesh)
-					+ CalcUVComponent(weightV2, depthV2, index2, mesh)) * interpolateDepthW
-				};
+		if (!isMeshInsideFrustum)
+		{
+			frustumTest = m_Frustum.Test(BoundingSphere{ center, radius });
 
-				finalColor = m_pTexture->Sample(uvPixel);
-			}
-			else
+			if (frustumTest == FrustumTest::Outside)
 			{
-				const float colorDepth{ Remap(interpolateDepthZ, 0.985f, 1.0f) };
+				++m_NrOfMeshletsCulled;
+				continue;
+			}
+		}
+
+		//The cone is only carried to world space by rotation and uniform scale, which is all the scene uses
+		if (mesh.cullMode != CullMode::None && meshlet.coneCos > 0.f)
+		{
+			const Vector3 axis{ mesh.worldMatrix.TransformVector(meshlet.coneAxis).Normalized() * coneDirection };
 
-				finalColor = { colorDepth, colorDepth, colorDepth };
+			if (IsConeFacingAway(center, radius, axis, meshlet.coneCos, meshlet.coneSin, m_CameraOrigin))
+			{
+				++m_NrOfMeshletsFacingAway;
+				continue;
 			}
+		}
+
+		m_VisibleMeshlets.emplace_back(VisibleMeshlet{ meshletIndex, frustumTest == FrustumTest::Inside });
+	}
+}
+
+bool Renderer::IsConeFacingAway(const Vector3& center, const float radius, const Vector3& axis, const float coneCos, const float coneSin, const Vector3& eye)
+{
+	//A triangle faces away when dot(normal, point - eye) > 0
+	//With theta the angle between the axis and the direction to the center, the worst normal in the cone is theta + cone angle away from it
+	//and the worst point of the sphere takes off at most the radius
+	const Vector3 toCenter{ center - eye };
+	const float distance{ toCenter.Magnitude() };
+
+	if (distance <= radius) return false;
+
+	const float cosTheta{ Vector3::Dot(toCenter, axis) / distance };
+	const float sinTheta{ std::sqrt(std::max(0.f, 1.f - cosTheta * cosTheta)) };
+
+	return (cosTheta * coneCos - sinTheta * coneSin) * distance > radius;
+}
+
+void Renderer::TransformPositions(Mesh& mesh, const Matrix& worldViewProjectionMatrix, const size_t beginIndex, const size_t endIndex)
+{
+	using namespace SIMD;
+
+	//Matrix::TransformPoint with w = 1, the perspective divide and ToScreenSpace, in the same order of operations
+	Floats matrix[4][4]{};
+
+	for (int row{}; row < 4; ++row)
+	{
+		for (int column{}; column < 4; ++column)
+		{
+			matrix[row][column] = Set(worldViewProjectionMatrix[row][column]);
+		}
+	}
+
+	const Floats one{ Set(1.f) };
+	const Floats half{ Set(0.5f) };
+	const Floats width{ Set(static_cast<float>(m_Width)) };
+	const Floats height{ Set(static_cast<float>(m_Height)) };
+
+	for (size_t groupIndex{ beginIndex }; groupIndex < endIndex; groupIndex += LANE_COUNT)
+	{
+		//Chunks start on a group boundary, so with the aligned streams every group is aligned as well
+		const Floats x{ LoadAligned(mesh.positionsX.data() + groupIndex) };
+		const Floats y{ LoadAligned(mesh.positionsY.data() + groupIndex) };
+		const Floats z{ LoadAligned(mesh.positionsZ.data() + groupIndex) };
+
+		Floats clip[4]{};
+
+		for (int column{}; column < 4; ++column)
+		{
+			clip[column] = Add(Add(Add(Mul(matrix[0][column], x), Mul(matrix[1][column], y)), Mul(matrix[2][column], z)), matrix[3][column]);
+		}
+
+		const Floats ndcX{ Div(clip[0], clip[3]) };
+		const Floats ndcY{ Div(clip[1], clip[3]) };
+		const Floats ndcZ{ Div(clip[2], clip[3]) };
+
+		//Halving is exact, so multiplying by a half matches the division by 2 of ToScreenSpace
+		const Floats screenX{ Mul(Mul(Add(ndcX, one), half), width) };
+		const Floats screenY{ Mul(Mul(Sub(one, ndcY), half), height) };
 
+		//The later stages look vertices up by index, one at a time, so the results go back out per vertex
+		alignas(32) float lanes[9][LANE_COUNT]{};
 
-			//Update Color in Buffer
-			finalColor.MaxToOne();
+		StoreAligned(lanes[0], clip[0]);
+		StoreAligned(lanes[1], clip[1]);
+		StoreAligned(lanes[2], clip[2]);
+		StoreAligned(lanes[3], clip[3]);
+		StoreAligned(lanes[4], ndcX);
+		StoreAligned(lanes[5], ndcY);
+		StoreAligned(lanes[6], ndcZ);
+		StoreAligned(lanes[7], screenX);
+		StoreAligned(lanes[8], screenY);
 
-			m_pBackBufferPixels[pixelIndex] = SDL_MapRGB(m_pBackBuffer->format,
-				static_cast<uint8_t>(finalColor.r * 255),
-				static_cast<uint8_t>(finalColor.g * 255),
-				static_cast<uint8_t>(finalColor.b * 255));
+		const size_t nrOfLanes{ std::min(endIndex - groupIndex, static_cast<size_t>(LANE_COUNT)) };
+
+		for (size_t lane{}; lane < nrOfLanes; ++lane)
+		{
+			const size_t vertexIndex{ groupIndex + lane };
+
+			m_Vertices_ClipSpace[vertexIndex] = Vector4{ lanes[0][lane], lanes[1][lane], lanes[2][lane], lanes[3][lane] };
+			mesh.positions_out[vertexIndex] = Vector4{ lanes[4][lane], lanes[5][lane], lanes[6][lane], lanes[3][lane] };
+			m_Vertices_ScreenSpace[vertexIndex] = Vector2{ lanes[7][lane], lanes[8][lane] };
 		}
 	}
 }
 
-bool dae::Renderer::IsOutOfFrustrum(const Vertex_Out& v) const
+Vector2 Renderer::ToScreenSpace(const Vector4& ndc) const
 {
-	return (v.position.x < -1 || v.position.x > 1) || (v.position.y < -1 || v.position.y > 1) || (v.position.z < 0 || v.position.z > 1);
+	return Vector2{
+		((ndc.x + 1) / 2) * m_Width,
+		((1 - ndc.y) / 2) * m_Height };
 }
 
-bool Renderer::SaveBufferToImage() const
+void Renderer::InitializeTiles()
 {
-	return SDL_SaveBMP(m_pBackBuffer, "Rasterizer_ColorBuffer.bmp");
+	m_NrOfTilesX = (m_Width + m_TileSize - 1) / m_TileSize;
+	m_NrOfTilesY = (m_Height + m_TileSize - 1) / m_TileSize;
+
+	m_Tiles.resize(static_cast<size_t>(m_NrOfTilesX) * m_NrOfTilesY);
+
+	for (int tileY{}; tileY < m_NrOfTilesY; ++tileY)
+	{
+		for (int tileX{}; tileX < m_NrOfTilesX; ++tileX)
+		{
+			Tile& tile{ m_Tiles[tileX + tileY * m_NrOfTilesX] };
+
+			tile.minX = tileX * m_TileSize;
+			tile.minY = tileY * m_TileSize;
+			tile.maxX = std::min(tile.minX + m_TileSize, m_Width);
+			tile.maxY = std::min(tile.minY + m_TileSize, m_Height);
+		}
+	}
+
+	//Tiles are a whole number of depth blocks, so no block is ever shared between two threads
+	static_assert(m_TileSize % m_DepthBlockSize == 0);
+
+	m_NrOfDepthBlocksX = (m_Width + m_DepthBlockSize - 1) / m_DepthBlockSize;
+	const int nrOfDepthBlocksY{ (m_Height + m_DepthBlockSize - 1) / m_DepthBlockSize };
+
+	m_DepthBlockMax.resize(static_cast<size_t>(m_NrOfDepthBlocksX) * nrOfDepthBlocksY);
+	m_IsDepthBlockDirty.resize(m_DepthBlockMax.size());
 }
 
-Vector2 Renderer::CalcUVComponent(const float weight, const float depth, const size_t index, const Mesh& mesh) const
+void Renderer::ClearTile(Tile& tile)
 {
-	return (weight * mesh.vertices[index].uv) / depth;
+	const int tileWidth{ tile.maxX - tile.minX };
+
+	for (int py{ tile.minY }; py < tile.maxY; ++py)
+	{
+		const int rowIndex{ tile.minX + py * m_Width };
+
+		//The resolve writes every pixel of the tile to the back buffer
+		if (m_Settings.isUsingMultisampling)
+		{
+			std::fill_n(m_pSampleDepthPixels + rowIndex * NR_OF_SAMPLES, tileWidth * NR_OF_SAMPLES, FLT_MAX);
+			std::fill_n(m_pSampleColorPixels + rowIndex * NR_OF_SAMPLES, tileWidth * NR_OF_SAMPLES, m_BackgroundColor);
+			continue;
+		}
+
+		std::fill_n(m_pDepthBufferPixels + rowIndex, tileWidth, FLT_MAX);
+		std::fill_n(m_pBackBufferPixels + rowIndex, tileWidth, m_BackgroundColor);
+
+		if (m_Settings.isUsingVisibilityBuffer) std::fill_n(m_pVisibilityBufferPixels + rowIndex, tileWidth, m_EmptyVisibilityId);
+	}
+
+	tile.isCleared = true;
+}
+
+void Renderer::FillUntouchedTiles()
+{
+	using namespace SIMD;
+
+	const Ints background{ Set(m_BackgroundColor) };
+
+	m_ThreadPool.ParallelFor(static_cast<uint32_t>(m_Tiles.size()), [&](uint32_t tileIndex)
+	{
+		const Tile& tile{ m_Tiles[tileIndex] };
+
+		if (tile.isCleared) return;
+
+		//Nothing reads these pixels before SDL does, so they are streamed past the caches
+		//Only whole aligned vectors can be streamed, the rest of the row is stored normally
+		for (int py{ tile.minY }; py < tile.maxY; ++py)
+		{
+			uint32_t* pPixel{ m_pBackBufferPixels + tile.minX + py * m_Width };
+			uint32_t* const pRowEnd{ m_pBackBufferPixels + tile.maxX + py * m_Width };
+
+			for (; pPixel < pRowEnd && reinterpret_cast<uintptr_t>(pPixel) % sizeof(Ints) != 0; ++pPixel) *pPixel = m_BackgroundColor;
+			for (; pPixel + LANE_COUNT <= pRowEnd; pPixel += LANE_COUNT) Stream(pPixel, background);
+			for (; pPixel < pRowEnd; ++pPixel) *pPixel = m_BackgroundColor;
+		}
+
+		StreamFence();
+	});
+}
+
+void Renderer::ClearHierarchicalDepth()
+{
+	std::fill(m_DepthBlockMax.begin(), m_DepthBlockMax.end(), FLT_MAX);
+	std::fill(m_IsDepthBlockDirty.begin(), m_IsDepthBlockDirty.end(), uint8_t{});
+
+	for (Tile& tile : m_Tiles)
+	{
+		tile.maxDepth = FLT_MAX;
+	}
+}
+
+float Renderer::GetMaxDepth(const int minX, const int minY, const int maxX, const int maxY) const
+{
+	float maxDepth{};
+
+	for (int blockY{ minY / m_DepthBlockSize }; blockY <= (maxY - 1) / m_DepthBlockSize; ++blockY)
+	{
+		for (int blockX{ minX / m_DepthBlockSize }; blockX <= (maxX - 1) / m_DepthBlockSize; ++blockX)
+		{
+			maxDepth = std::max(maxDepth, m_DepthBlockMax[blockX + blockY * m_NrOfDepthBlocksX]);
+		}
+	}
+
+	return maxDepth;
+}
+
+void Renderer::RefreshDepthBlocks(const int minX, const int minY, const int maxX, const int maxY)
+{
+	for (int blockY{ minY / m_DepthBlockSize }; blockY <= (maxY - 1) / m_DepthBlockSize; ++blockY)
+	{
+		for (int blockX{ minX / m_DepthBlockSize }; blockX <= (maxX - 1) / m_DepthBlockSize; ++blockX)
+		{
+			if (m_IsDepthBlockDirty[blockX + blockY * m_NrOfDepthBlocksX]) RefreshBlockMaxDepth(blockX, blockY);
+		}
+	}
+}
+
+void Renderer::RefreshBlockMaxDepth(const int blockX, const int blockY)
+{
+	const int blockIndex{ blockX + blockY * m_NrOfDepthBlocksX };
+
+	const int minX{ blockX * m_DepthBlockSize };
+	const int minY{ blockY * m_DepthBlockSize };
+	const int maxX{ std::min(minX + m_DepthBlockSize, m_Width) };
+	const int maxY{ std::min(minY + m_DepthBlockSize, m_Height) };
+
+	//In multisample mode every pixel has its own set of sample depths
+	const float* pDepths{ m_Settings.isUsingMultisampling ? m_pSampleDepthPixels : m_pDepthBufferPixels };
+	const int nrOfDepthsPerPixel{ m_Settings.isUsingMultisampling ? NR_OF_SAMPLES : 1 };
+
+	float maxDepth{};
+
+	for (int py{ minY }; py < maxY; ++py)
+	{
+		for (int depthIndex{ (minX + py * m_Width) * nrOfDepthsPerPixel }; depthIndex < (maxX + py * m_Width) * nrOfDepthsPerPixel; ++depthIndex)
+		{
+			const float depth{ pDepths[depthIndex] };
+
+			//A NaN depth lets every later pixel through, so nothing may be rejected against this block
+			maxDepth = std::isnan(depth) ? FLT_MAX : std::max(maxDepth, depth);
+		}
+	}
+
+	m_DepthBlockMax[blockIndex] = maxDepth;
+	m_IsDepthBlockDirty[blockIndex] = false;
+}
+
+void Renderer::MarkDepthDirty(const int minX, const int minY, const int maxX, const int maxY, const bool isDepthFinite)
+{
+	for (int blockY{ minY / m_DepthBlockSize }; blockY <= (maxY - 1) / m_DepthBlockSize; ++blockY)
+	{
+		for (int blockX{ minX / m_DepthBlockSize }; blockX <= (maxX - 1) / m_DepthBlockSize; ++blockX)
+		{
+			const int blockIndex{ blockX + blockY * m_NrOfDepthBlocksX };
+
+			m_IsDepthBlockDirty[blockIndex] = true;
+			if (!isDepthFinite) m_DepthBlockMax[blockIndex] = FLT_MAX;
+		}
+	}
+}
+
+void Renderer::BinTriangles(Mesh& mesh)
+{
+	//Room for every triangle of the index buffer, clipping can add more
+	const size_t nrOfTriangles{ mesh.primitiveTopology == PrimitiveTopology::TriangleList ? mesh.indices.size() / 3 : mesh.indices.size() };
+	m_Triangles = FrameArray<Triangle>{ m_FrameArena, nrOfTriangles };
+
+	for (Tile& tile : m_Tiles)
+	{
+		tile.triangleIndices.clear();
+	}
+
+	switch (mesh.primitiveTopology)
+	{
+		case PrimitiveTopology::TriangleList:
+		{
+			//Only the meshlets that survived culling, their vertices are the only ones that were transformed
+			for (const VisibleMeshlet& visibleMeshlet : m_VisibleMeshlets)
+			{
+				const Meshlet& meshlet{ mesh.meshlets[visibleMeshlet.meshletIndex] };
+
+				m_IsInsideFrustum = visibleMeshlet.isInsideFrustum;
+
+				for (uint32_t triangleIndex{ meshlet.firstTriangle }; triangleIndex < meshlet.firstTriangle + meshlet.nrOfTriangles; ++triangleIndex)
+				{
+					SetupTriangle(triangleIndex * size_t{ 3 }, mesh, false);
+				}
+			}
+		}
+		break;
+				
+		case PrimitiveTopology::TriangleStrip:
+		{
+			for (size_t vertexIndex{}; vertexIndex < mesh.indices.size() - 2; ++vertexIndex)
+			{
+				SetupTriangle(vertexIndex, mesh, vertexIndex % 2);
+			}
+		}
+		break;
+
+	}
+}
+
+void Renderer::SetupTriangle(const size_t index, Mesh& mesh, const bool swapVertices)
+{
+	const uint32_t index0{ mesh.indices[index]};
+	const uint32_t index1{ mesh.indices[index + 1 + swapVertices] };
+	const uint32_t index2{ mesh.indices[index + 1 + !swapVertices]  };
+
+	if (index0 == index1 || index1 == index2 || index0 == index2) return;
+
+	if (m_IsInsideFrustum)
+	{
+		BinTriangle(index0, index1, index2, mesh.cullMode);
+		return;
+	}
+
+	const Vector4& clip0{ m_Vertices_ClipSpace[index0] };
+	const Vector4& clip1{ m_Vertices_ClipSpace[index1] };
+	const Vector4& clip2{ m_Vertices_ClipSpace[index2] };
+
+	//Trivial reject: all three vertices on the outside of the same frustum plane
+	if (ComputeOutcode(clip0, 1.f) & ComputeOutcode(clip1, 1.f) & ComputeOutcode(clip2, 1.f)) return;
+
+	//Trivial accept: everything between near and far and inside the guard band, the rasterizer handles the rest
+	//Only the planes that are actually crossed get clipped against
+	const uint8_t crossedPlanes{ static_cast<uint8_t>(ComputeOutcode(clip0, m_GuardBand) | ComputeOutcode(clip1, m_GuardBand) | ComputeOutcode(clip2, m_GuardBand)) };
+
+	if (crossedPlanes == 0) BinTriangle(index0, index1, index2, mesh.cullMode);
+	else ClipTriangle(mesh, index0, index1, index2, crossedPlanes);
+}
+
+uint8_t Renderer::ComputeOutcode(const Vector4& clip, const float guardBand) const
+{
+	uint8_t outcode{};
+
+	if (clip.x < -guardBand * clip.w) outcode |= ClipPlaneLeft;
+	if (clip.x > guardBand * clip.w) outcode |= ClipPlaneRight;
+	if (clip.y < -guardBand * clip.w) outcode |= ClipPlaneBottom;
+	if (clip.y > guardBand * clip.w) outcode |= ClipPlaneTop;
+	if (clip.z < 0) outcode |= ClipPlaneNear;
+	if (clip.z > clip.w) outcode |= ClipPlaneFar;
+
+	return outcode;
+}
+
+void Renderer::ClipTriangle(Mesh& mesh, const uint32_t index0, const uint32_t index1, const uint32_t index2, const uint8_t planes)
+{
+	//Signed distance to a clip plane in homogeneous space, positive is inside
+	const auto planeDistance = [this](const Vector4& clip, const uint8_t plane)
+	{
+		switch (plane)
+		{
+			case ClipPlaneLeft: return clip.x + m_GuardBand * clip.w;
+			case ClipPlaneRight: return m_GuardBand * clip.w - clip.x;
+			case ClipPlaneBottom: return clip.y + m_GuardBand * clip.w;
+			case ClipPlaneTop: return m_GuardBand * clip.w - clip.y;
+			case ClipPlaneNear: return clip.z;
+			default: return clip.w - clip.z;
+		}
+	};
+
+	//Clipping a convex polygon adds at most one vertex per plane
+	constexpr int maxNrOfVertices{ 3 + 6 };
+
+	Vertex_Out polygon[maxNrOfVertices]{};
+	Vertex_Out clipped[maxNrOfVertices]{};
+
+	const uint32_t triangleIndices[3]{ index0, index1, index2 };
+
+	for (int vertexIndex{}; vertexIndex < 3; ++vertexIndex)
+	{
+		polygon[vertexIndex].position = m_Vertices_ClipSpace[triangleIndices[vertexIndex]];
+		std::copy_n(mesh.varyings_out.data() + triangleIndices[vertexIndex] * mesh.varyingCount, mesh.varyingCount, polygon[vertexIndex].varyings);
+	}
+
+	int nrOfVertices{ 3 };
+
+	//Sutherland-Hodgman, every attribute is interpolated in clip space so the result stays perspective correct
+	for (uint8_t plane{ ClipPlaneLeft }; plane <= ClipPlaneFar; plane <<= 1)
+	{
+		if (!(planes & plane)) continue;
+
+		int nrOfClippedVertices{};
+
+		for (int vertexIndex{}; vertexIndex < nrOfVertices; ++vertexIndex)
+		{
+			const Vertex_Out& current{ polygon[vertexIndex] };
+			const Vertex_Out& next{ polygon[(vertexIndex + 1) % nrOfVertices] };
+
+			const float currentDistance{ planeDistance(current.position, plane) };
+			const float nextDistance{ planeDistance(next.position, plane) };
+
+			if (currentDistance >= 0) clipped[nrOfClippedVertices++] = current;
+
+			if ((currentDistance >= 0) != (nextDistance >= 0))
+			{
+				clipped[nrOfClippedVertices++] = LerpVertex(current, next, currentDistance / (currentDistance - nextDistance));
+			}
+		}
+
+		nrOfVertices = nrOfClippedVertices;
+		if (nrOfVertices < 3) return;
+
+		std::copy_n(clipped, nrOfVertices, polygon);
+	}
+
+	//Fan triangulate the polygon, it keeps the winding of the original triangle
+	uint32_t indices[maxNrOfVertices]{};
+
+	for (int vertexIndex{}; vertexIndex < nrOfVertices; ++vertexIndex)
+	{
+		indices[vertexIndex] = AddClippedVertex(mesh, polygon[vertexIndex]);
+	}
+
+	for (int vertexIndex{ 1 }; vertexIndex < nrOfVertices - 1; ++vertexIndex)
+	{
+		BinTriangle(indices[0], indices[vertexIndex], indices[vertexIndex + 1], mesh.cullMode);
+	}
+}
+
+Vertex_Out Renderer::LerpVertex(const Vertex_Out& v0, const Vertex_Out& v1, const float t) const
+{
+	//Varyings the pipeline doesn't use are zero and stay zero
+	Vertex_Out vertex{ v0.position + (v1.position - v0.position) * t };
+
+	for (int varyingIndex{}; varyingIndex < MAX_VARYINGS; ++varyingIndex)
+	{
+		vertex.varyings[varyingIndex] = v0.varyings[varyingIndex] + (v1.varyings[varyingIndex] - v0.varyings[varyingIndex]) * t;
+	}
+
+	return vertex;
+}
+
+uint32_t Renderer::AddClippedVertex(Mesh& mesh, Vertex_Out vertex)
+{
+	m_Vertices_ClipSpace.emplace_back(vertex.position);
+
+	vertex.position.x /= vertex.position.w;
+	vertex.position.y /= vertex.position.w;
+	vertex.position.z /= vertex.position.w;
+
+	m_Vertices_ScreenSpace.emplace_back(ToScreenSpace(vertex.position));
+	mesh.positions_out.emplace_back(vertex.position);
+
+	for (int varyingIndex{}; varyingIndex < mesh.varyingCount; ++varyingIndex)
+	{
+		mesh.varyings_out.emplace_back(vertex.varyings[varyingIndex]);
+	}
+
+	return static_cast<uint32_t>(mesh.positions_out.size() - 1);
+}
+
+void Renderer::BinTriangle(uint32_t index0, uint32_t index1, uint32_t index2, const CullMode cullMode)
+{
+	//Cull before the bounding box is binned, so a dropped triangle never reaches a tile
+	const float triangleArea{ Vector2::Cross(m_Vertices_ScreenSpace[index1] - m_Vertices_ScreenSpace[index0], m_Vertices_ScreenSpace[index2] - m_Vertices_ScreenSpace[index0]) };
+
+	if (std::abs(triangleArea) < m_MinTriangleArea)
+	{
+		++m_NrOfZeroAreaCulled;
+		return;
+	}
+
+	const bool isFrontFacing{ triangleArea > 0.f };
+
+	if (!isFrontFacing && cullMode == CullMode::Back)
+	{
+		++m_NrOfBackFacesCulled;
+		return;
+	}
+
+	if (isFrontFacing && cullMode == CullMode::Front)
+	{
+		++m_NrOfFrontFacesCulled;
+		return;
+	}
+
+	//The rasterizer only walks positive areas, flip the winding of the back faces that are kept
+	if (!isFrontFacing) std::swap(index1, index2);
+
+	const Vector2& v0{ m_Vertices_ScreenSpace[index0] };
+	const Vector2& v1{ m_Vertices_ScreenSpace[index1] };
+	const Vector2& v2{ m_Vertices_ScreenSpace[index2] };
+
+	AABB boundingBox
+	{
+		boundingBox.minAABB = Vector2::Min(v0, Vector2::Min(v1, v2)),
+		boundingBox.maxAABB = Vector2::Max(v0, Vector2::Max(v1, v2))
+	};
+
+	boundingBox.minAABB.Clamp((float)m_Width, (float)m_Height);
+	boundingBox.maxAABB.Clamp((float)m_Width, (float)m_Height);
+
+	const int margin{ 1 };
+
+	Triangle triangle{ index0, index1, index2 };
+
+	triangle.minX = std::clamp(static_cast<int>(boundingBox.minAABB.x - margin), 0, m_Width);
+	triangle.minY = std::clamp(static_cast<int>(boundingBox.minAABB.y - margin), 0, m_Height);
+
+	triangle.maxX = std::clamp(static_cast<int>(boundingBox.maxAABB.x + margin), 0, m_Width);
+	triangle.maxY = std::clamp(static_cast<int>(boundingBox.maxAABB.y + margin), 0, m_Height);
+
+	if (triangle.minX >= triangle.maxX || triangle.minY >= triangle.maxY) return;
+
+	const uint32_t triangleIndex{ static_cast<uint32_t>(m_Triangles.size()) };
+
+	//The load time check keeps the visibility pass within what an id can hold
+	assert(m_RenderPass != RenderPass::Visibility || (m_MeshIndex < m_MaxVisibilityMeshes && triangleIndex < m_MaxVisibilityTriangles));
+
+	m_Triangles.emplace_back(triangle);
+
+	//Bins are filled in submission order, so every tile still draws its triangles in the order of the index buffer
+	for (int tileY{ triangle.minY / m_TileSize }; tileY <= (triangle.maxY - 1) / m_TileSize; ++tileY)
+	{
+		for (int tileX{ triangle.minX / m_TileSize }; tileX <= (triangle.maxX - 1) / m_TileSize; ++tileX)
+		{
+			m_Tiles[tileX + tileY * m_NrOfTilesX].triangleIndices.emplace_back(triangleIndex);
+		}
+	}
+}
+
+template<typename Pipeline>
+void Renderer::RenderTile(Tile& tile, const Mesh& mesh)
+{
+	if (tile.triangleIndices.empty()) return;
+
+	if (!tile.isCleared) ClearTile(tile);
+
+	for (const uint32_t triangleIndex : tile.triangleIndices)
+	{
+		RenderTriangle<Pipeline>(triangleIndex, mesh, tile);
+	}
+
+	//Tighten the blocks and the tile level for the meshes that come after this one
+	RefreshDepthBlocks(tile.minX, tile.minY, tile.maxX, tile.maxY);
+	tile.maxDepth = GetMaxDepth(tile.minX, tile.minY, tile.maxX, tile.maxY);
+}
+
+template<typename Pipeline>
+void Renderer::RenderTriangle(const uint32_t triangleIndex, const Mesh& mesh, Tile& tile)
+{
+	const Triangle& triangle{ m_Triangles[triangleIndex] };
+
+	TriangleSetup setup{};
+	ClampToTile(setup, triangle, tile);
+
+	//The interpolated depth is a weighted average of the vertex depths, so in exact arithmetic it never gets nearer than the nearest vertex
+	//Rounding can put it slightly nearer, the bias keeps the reject conservative
+	//When that is still behind everything already drawn in the covered blocks, no pixel can pass the depth test
+	const float minDepth
+	{
+		std::min(mesh.positions_out[triangle.index0].z, std::min(mesh.positions_out[triangle.index1].z, mesh.positions_out[triangle.index2].z)) - m_DepthRejectBias
+	};
+
+	//The shading pass finds each pixel's own triangle in the depth buffer, the pre-pass already did all the occlusion culling
+	//Rejecting against depths that are exactly this triangle's could only drop pixels it owns
+	const bool isUsingHierarchicalDepth{ m_RenderPass != RenderPass::Shade };
+
+	if (isUsingHierarchicalDepth)
+	{
+		if (minDepth > tile.maxDepth) return;
+		if (minDepth > GetMaxDepth(setup.minX, setup.minY, setup.maxX, setup.maxY)) return;
+	}
+
+	if (!SetupInterpolation<typename Pipeline::Varyings>(setup, triangle, mesh, m_Vertices_ScreenSpace)) return;
+
+	const bool isDepthOnly{ m_RenderPass == RenderPass::DepthOnly || m_RenderPass == RenderPass::Visibility };
+	const uint32_t visibilityId{ (m_MeshIndex << m_TriangleIdBits) | triangleIndex };
+
+	const bool isMultisampling{ m_RenderPass == RenderPass::Multisample };
+	const MultisampleSetup multisample{ isMultisampling ? SetupMultisample(setup) : MultisampleSetup{} };
+
+	//Row major traversal: every scanline is first clipped to the exact span the triangle covers on it,
+	//then that contiguous run of pixels is shaded without any further edge tests
+	//Rows are walked in bands of one depth block high, a band that is occluded over the whole bounding box width is skipped
+	for (int bandY{ setup.minY }; bandY < setup.maxY; bandY = (bandY / m_DepthBlockSize + 1) * m_DepthBlockSize)
+	{
+		const int bandMaxY{ std::min((bandY / m_DepthBlockSize + 1) * m_DepthBlockSize, setup.maxY) };
+
+		if (isUsingHierarchicalDepth && minDepth > GetMaxDepth(setup.minX, bandY, setup.maxX, bandMaxY)) continue;
+
+		for (int py{ bandY }; py < bandMaxY; ++py)
+		{
+			int spanBeginX{ setup.minX };
+			int spanEndX{ setup.maxX };
+
+			if (isMultisampling) ClipSpanMultisample(setup, multisample, py, spanBeginX, spanEndX);
+			else if (m_Settings.isUsingFixedPoint) ClipSpanFixed(setup, py, spanBeginX, spanEndX);
+			else ClipSpan(setup, py, spanBeginX, spanEndX);
+
+			if (spanBeginX >= spanEndX) continue;
+
+			if (isMultisampling) RenderSpanMultisample<Pipeline>(setup, multisample, py, spanBeginX, spanEndX);
+			else if (isDepthOnly) RenderSpanDepth(setup, py, spanBeginX, spanEndX, visibilityId);
+			else RenderSpan<Pipeline>(setup, py, spanBeginX, spanEndX);
+		}
+	}
+
+	//The shading pass leaves the depth buffer as the pre-pass left it
+	if (m_RenderPass != RenderPass::Shade)
+	{
+		const bool isDepthFinite{ std::isfinite(setup.depthZ.start) && std::isfinite(setup.depthZ.stepX) && std::isfinite(setup.depthZ.stepY) };
+		MarkDepthDirty(setup.minX, setup.minY, setup.maxX, setup.maxY, isDepthFinite);
+	}
+}
+
+void Renderer::ClampToTile(TriangleSetup& setup, const Triangle& triangle, const Tile& tile) const
+{
+	setup.minX = std::max(triangle.minX, tile.minX);
+	setup.minY = std::max(triangle.minY, tile.minY);
+
+	setup.maxX = std::min(triangle.maxX, tile.maxX);
+	setup.maxY = std::min(triangle.maxY, tile.maxY);
+	setup.tileMaxX = tile.maxX;
+}
+
+template<typename Varyings>
+bool Renderer::SetupInterpolation(TriangleSetup& setup, const Triangle& triangle, const Mesh& mesh, const FrameArray<Vector2>& verticesScreenSpace) const
+{
+	const Vector4& positionV0{ mesh.positions_out[triangle.index0] };
+	const Vector4& positionV1{ mesh.positions_out[triangle.index1] };
+	const Vector4& positionV2{ mesh.positions_out[triangle.index2] };
+
+	const Vector2& v0{ verticesScreenSpace[triangle.index0] };
+	const Vector2& v1{ verticesScreenSpace[triangle.index1] };
+	const Vector2& v2{ verticesScreenSpace[triangle.index2] };
+
+	//Sample coverage is always decided on the subpixel grid
+	const bool isUsingFixedPoint{ m_Settings.isUsingFixedPoint || m_RenderPass == RenderPass::Multisample };
+	const bool isFacingCamera{ isUsingFixedPoint ? SetupEdgesFixed(setup, v0, v1, v2) : SetupEdges(setup, v0, v1, v2) };
+
+	if (!isFacingCamera) return false;
+
+	setup.depthZ = SetupPlane(setup, positionV0.z, positionV1.z, positionV2.z);
+
+	if constexpr (Varyings::COUNT > 0)
+	{
+		//Anything divided by w is linear in screen space, so the per vertex divisions happen here once instead of in every pixel
+		const float invDepthWV0{ 1 / positionV0.w };
+		const float invDepthWV1{ 1 / positionV1.w };
+		const float invDepthWV2{ 1 / positionV2.w };
+
+		setup.invDepthW = SetupPlane(setup, invDepthWV0, invDepthWV1, invDepthWV2);
+
+		//The mesh was transformed by the vertex shader of this same pipeline, so its varyings have this layout
+		const float* varyingsV0{ mesh.varyings_out.data() + triangle.index0 * Varyings::COUNT };
+		const float* varyingsV1{ mesh.varyings_out.data() + triangle.index1 * Varyings::COUNT };
+		const float* varyingsV2{ mesh.varyings_out.data() + triangle.index2 * Varyings::COUNT };
+
+		for (int varyingIndex{}; varyingIndex < Varyings::COUNT; ++varyingIndex)
+		{
+			setup.varyingsOverW[varyingIndex] = SetupPlane(setup,
+				varyingsV0[varyingIndex] * invDepthWV0, varyingsV1[varyingIndex] * invDepthWV1, varyingsV2[varyingIndex] * invDepthWV2);
+		}
+	}
+
+	return true;
+}
+
+AttributePlane Renderer::SetupPlane(const TriangleSetup& setup, const float valueV0, const float valueV1, const float valueV2) const
+{
+	return AttributePlane
+	{
+		setup.startWeightV0 * valueV0 + setup.startWeightV1 * valueV1 + setup.startWeightV2 * valueV2,
+		setup.stepXWeightV0 * valueV0 + setup.stepXWeightV1 * valueV1 + setup.stepXWeightV2 * valueV2,
+		setup.stepYWeightV0 * valueV0 + setup.stepYWeightV1 * valueV1 + setup.stepYWeightV2 * valueV2
+	};
+}
+
+template<typename Varyings>
+AttributeRow Renderer::GetAttributeRow(const TriangleSetup& setup, const int py) const
+{
+	const float dy{ static_cast<float>(py - setup.minY) };
+
+	AttributeRow row{};
+
+	row.depthZ = setup.depthZ.start + setup.depthZ.stepY * dy;
+
+	if constexpr (Varyings::COUNT > 0)
+	{
+		row.invDepthW = setup.invDepthW.start + setup.invDepthW.stepY * dy;
+
+		for (int varyingIndex{}; varyingIndex < Varyings::COUNT; ++varyingIndex)
+		{
+			row.varyingsOverW[varyingIndex] = setup.varyingsOverW[varyingIndex].start + setup.varyingsOverW[varyingIndex].stepY * dy;
+		}
+	}
+
+	return row;
+}
+
+bool Renderer::SetupEdges(TriangleSetup& setup, const Vector2& v0, const Vector2& v1, const Vector2& v2) const
+{
+	const Vector2 edgeV0V1{ v1 - v0 };
+	const Vector2 edgeV1V2{ v2 - v1 };
+	const Vector2 edgeV2V0{ v0 - v2 };
+
+	const float triangleArea{ Vector2::Cross(edgeV0V1, edgeV1V2) };
+
+	//All three edge functions add up to the area, so a triangle without a positive area can't cover any pixel
+	if (triangleArea <= 0.f) return false;
+
+	const float invTriangleArea{ 1 / triangleArea };
+
+	//The edge functions, and so the barycentric weights, are linear in screen space
+	//Evaluate them once at the first pixel and only step them from there
+	const Vector2 startPoint{ static_cast<float>(setup.minX), static_cast<float>(setup.minY) };
+
+	setup.startWeightV0 = Vector2::Cross(edgeV1V2, startPoint - v1) * invTriangleArea;
+	setup.startWeightV1 = Vector2::Cross(edgeV2V0, startPoint - v2) * invTriangleArea;
+	setup.startWeightV2 = Vector2::Cross(edgeV0V1, startPoint - v0) * invTriangleArea;
+
+	//Cross(edge, point - v) changes with -edge.y for a step in x and with edge.x for a step in y
+	setup.stepXWeightV0 = -edgeV1V2.y * invTriangleArea;
+	setup.stepXWeightV1 = -edgeV2V0.y * invTriangleArea;
+	setup.stepXWeightV2 = -edgeV0V1.y * invTriangleArea;
+
+	setup.stepYWeightV0 = edgeV1V2.x * invTriangleArea;
+	setup.stepYWeightV1 = edgeV2V0.x * invTriangleArea;
+	setup.stepYWeightV2 = edgeV0V1.x * invTriangleArea;
+
+	return true;
+}
+
+bool Renderer::SetupEdgesFixed(TriangleSetup& setup, const Vector2& v0, const Vector2& v1, const Vector2& v2) const
+{
+	//Snap the vertices to the subpixel grid, from here on coverage is decided with exact integer math
+	const float subpixelScale{ static_cast<float>(1 << m_SubpixelBits) };
+
+	const int64_t x0{ std::llround(v0.x * subpixelScale) };
+	const int64_t y0{ std::llround(v0.y * subpixelScale) };
+	const int64_t x1{ std::llround(v1.x * subpixelScale) };
+	const int64_t y1{ std::llround(v1.y * subpixelScale) };
+	const int64_t x2{ std::llround(v2.x * subpixelScale) };
+	const int64_t y2{ std::llround(v2.y * subpixelScale) };
+
+	const int64_t edgeV0V1X{ x1 - x0 }, edgeV0V1Y{ y1 - y0 };
+	const int64_t edgeV1V2X{ x2 - x1 }, edgeV1V2Y{ y2 - y1 };
+	const int64_t edgeV2V0X{ x0 - x2 }, edgeV2V0Y{ y0 - y2 };
+
+	const int64_t triangleArea{ edgeV0V1X * edgeV1V2Y - edgeV0V1Y * edgeV1V2X };
+
+	if (triangleArea <= 0) return false;
+
+	const float invTriangleArea{ 1.f / static_cast<float>(triangleArea) };
+
+	//Sample point of pixel (minX, minY) on the subpixel grid
+	const int64_t startX{ static_cast<int64_t>(setup.minX) << m_SubpixelBits };
+	const int64_t startY{ static_cast<int64_t>(setup.minY) << m_SubpixelBits };
+
+	const int64_t startEdgeV0{ edgeV1V2X * (startY - y1) - edgeV1V2Y * (startX - x1) };
+	const int64_t startEdgeV1{ edgeV2V0X * (startY - y2) - edgeV2V0Y * (startX - x2) };
+	const int64_t startEdgeV2{ edgeV0V1X * (startY - y0) - edgeV0V1Y * (startX - x0) };
+
+	//Top-left fill rule: a sample exactly on an edge only belongs to the triangle if that edge is a top or a left edge
+	//With y pointing down and the interior on the positive side, left edges go up and top edges go right
+	const auto fillRuleBias = [](const int64_t edgeX, const int64_t edgeY) -> int64_t
+	{
+		const bool isTopLeft{ edgeY < 0 || (edgeY == 0 && edgeX > 0) };
+		return isTopLeft ? 0 : -1;
+	};
+
+	setup.startEdgeV0 = startEdgeV0 + fillRuleBias(edgeV1V2X, edgeV1V2Y);
+	setup.startEdgeV1 = startEdgeV1 + fillRuleBias(edgeV2V0X, edgeV2V0Y);
+	setup.startEdgeV2 = startEdgeV2 + fillRuleBias(edgeV0V1X, edgeV0V1Y);
+
+	setup.stepXEdgeV0 = -edgeV1V2Y << m_SubpixelBits;
+	setup.stepXEdgeV1 = -edgeV2V0Y << m_SubpixelBits;
+	setup.stepXEdgeV2 = -edgeV0V1Y << m_SubpixelBits;
+
+	setup.stepYEdgeV0 = edgeV1V2X << m_SubpixelBits;
+	setup.stepYEdgeV1 = edgeV2V0X << m_SubpixelBits;
+	setup.stepYEdgeV2 = edgeV0V1X << m_SubpixelBits;
+
+	//The shading weights still come from the float expression, now built from the snapped vertices
+	setup.startWeightV0 = static_cast<float>(startEdgeV0) * invTriangleArea;
+	setup.startWeightV1 = static_cast<float>(startEdgeV1) * invTriangleArea;
+	setup.startWeightV2 = static_cast<float>(startEdgeV2) * invTriangleArea;
+
+	setup.stepXWeightV0 = static_cast<float>(setup.stepXEdgeV0) * invTriangleArea;
+	setup.stepXWeightV1 = static_cast<float>(setup.stepXEdgeV1) * invTriangleArea;
+	setup.stepXWeightV2 = static_cast<float>(setup.stepXEdgeV2) * invTriangleArea;
+
+	setup.stepYWeightV0 = static_cast<float>(setup.stepYEdgeV0) * invTriangleArea;
+	setup.stepYWeightV1 = static_cast<float>(setup.stepYEdgeV1) * invTriangleArea;
+	setup.stepYWeightV2 = static_cast<float>(setup.stepYEdgeV2) * invTriangleArea;
+
+	return true;
+}
+
+void Renderer::ClipSpan(const TriangleSetup& setup, const int py, int& beginX, int& endX) const
+{
+	const float dy{ static_cast<float>(py - setup.minY) };
+
+	const auto clipToEdge = [&](const float startWeight, const float stepXWeight, const float stepYWeight)
+	{
+		if (beginX >= endX) return;
+
+		const float rowWeight{ startWeight + stepYWeight * dy };
+
+		//Same expression as RenderSpan, along a row it is monotonic so the covered pixels form one interval
+		const auto isCovered = [&](const int px)
+		{
+			return !(rowWeight + stepXWeight * static_cast<float>(px - setup.minX) < 0);
+		};
+
+		if (stepXWeight == 0)
+		{
+			if (!isCovered(beginX)) endX = beginX;
+			return;
+		}
+
+		//Solve the edge for the scanline, then fix up the rounded guess by testing the pixels next to it
+		const float crossing{ static_cast<float>(setup.minX) - rowWeight / stepXWeight };
+		if (std::isnan(crossing)) return;
+
+		const int guess{ static_cast<int>(std::clamp(crossing, static_cast<float>(beginX), static_cast<float>(endX))) };
+
+		if (stepXWeight > 0)
+		{
+			//Weight grows to the right, the first covered pixel becomes the begin
+			int first{ guess };
+			while (first > beginX && isCovered(first - 1)) --first;
+			while (first < endX && !isCovered(first)) ++first;
+
+			beginX = first;
+		}
+		else
+		{
+			//Weight shrinks to the right, one past the last covered pixel becomes the end
+			int end{ guess };
+			while (end < endX && isCovered(end)) ++end;
+			while (end > beginX && !isCovered(end - 1)) --end;
+
+			endX = end;
+		}
+	};
+
+	clipToEdge(setup.startWeightV0, setup.stepXWeightV0, setup.stepYWeightV0);
+	clipToEdge(setup.startWeightV1, setup.stepXWeightV1, setup.stepYWeightV1);
+	clipToEdge(setup.startWeightV2, setup.stepXWeightV2, setup.stepYWeightV2);
+}
+
+void Renderer::ClipSpanFixed(const TriangleSetup& setup, const int py, int& beginX, int& endX) const
+{
+	ClipSpanFixed(setup, py, beginX, endX, 0, 0, 0);
+}
+
+void Renderer::ClipSpanFixed(const TriangleSetup& setup, const int py, int& beginX, int& endX,
+	const int64_t edgeOffsetV0, const int64_t edgeOffsetV1, const int64_t edgeOffsetV2) const
+{
+	const int64_t dy{ py - setup.minY };
+
+	//Floor and ceil of a / b for b > 0
+	const auto floorDivide = [](const int64_t a, const int64_t b) -> int64_t
+	{
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	};
+
+	const auto clipToEdge = [&](const int64_t startEdge, const int64_t stepXEdge, const int64_t stepYEdge)
+	{
+		if (beginX >= endX) return;
+
+		//Pixel px is covered when rowEdge + stepXEdge * (px - minX) >= 0, solved exactly for px
+		const int64_t rowEdge{ startEdge + stepYEdge * dy };
+
+		if (stepXEdge == 0)
+		{
+			if (rowEdge < 0) endX = beginX;
+		}
+		else if (stepXEdge > 0)
+		{
+			const int64_t firstX{ setup.minX - floorDivide(rowEdge, stepXEdge) };
+			beginX = static_cast<int>(std::clamp<int64_t>(firstX, beginX, endX));
+		}
+		else
+		{
+			const int64_t lastX{ setup.minX + floorDivide(rowEdge, -stepXEdge) };
+			endX = static_cast<int>(std::clamp<int64_t>(lastX + 1, beginX, endX));
+		}
+	};
+
+	clipToEdge(setup.startEdgeV0 + edgeOffsetV0, setup.stepXEdgeV0, setup.stepYEdgeV0);
+	clipToEdge(setup.startEdgeV1 + edgeOffsetV1, setup.stepXEdgeV1, setup.stepYEdgeV1);
+	clipToEdge(setup.startEdgeV2 + edgeOffsetV2, setup.stepXEdgeV2, setup.stepYEdgeV2);
+}
+
+void Renderer::ClipSpanMultisample(const TriangleSetup& setup, const MultisampleSetup& multisample, const int py, int& beginX, int& endX) const
+{
+	//Every sample covers one interval of the row, the span is the smallest one holding all of them
+	int unionBeginX{ endX };
+	int unionEndX{ beginX };
+
+	for (int sampleIndex{}; sampleIndex < NR_OF_SAMPLES; ++sampleIndex)
+	{
+		int sampleBeginX{ beginX };
+		int sampleEndX{ endX };
+
+		ClipSpanFixed(setup, py, sampleBeginX, sampleEndX,
+			multisample.edgeOffsetV0[sampleIndex], multisample.edgeOffsetV1[sampleIndex], multisample.edgeOffsetV2[sampleIndex]);
+
+		if (sampleBeginX >= sampleEndX) continue;
+
+		unionBeginX = std::min(unionBeginX, sampleBeginX);
+		unionEndX = std::max(unionEndX, sampleEndX);
+	}
+
+	beginX = unionBeginX;
+	endX = unionEndX;
+}
+
+MultisampleSetup Renderer::SetupMultisample(const TriangleSetup& setup) const
+{
+	MultisampleSetup multisample{};
+
+	for (int sampleIndex{}; sampleIndex < NR_OF_SAMPLES; ++sampleIndex)
+	{
+		const int offsetX{ m_SamplePositions[sampleIndex][0] };
+		const int offsetY{ m_SamplePositions[sampleIndex][1] };
+
+		//The edge steps are per whole pixel and a multiple of the subpixel scale, so eighths of them are exact
+		multisample.edgeOffsetV0[sampleIndex] = (setup.stepXEdgeV0 * offsetX + setup.stepYEdgeV0 * offsetY) / 8;
+		multisample.edgeOffsetV1[sampleIndex] = (setup.stepXEdgeV1 * offsetX + setup.stepYEdgeV1 * offsetY) / 8;
+		multisample.edgeOffsetV2[sampleIndex] = (setup.stepXEdgeV2 * offsetX + setup.stepYEdgeV2 * offsetY) / 8;
+
+		multisample.depthOffset[sampleIndex] = (setup.depthZ.stepX * offsetX + setup.depthZ.stepY * offsetY) / 8.f;
+	}
+
+	return multisample;
+}
+
+template<typename Pipeline>
+void Renderer::RenderSpan(const TriangleSetup& setup, const int py, const int beginX, const int endX)
+{
+	//Every pixel is row + stepX * dx, the vectorized kernels and the resolve pass evaluate it with that same expression
+	//so all of them agree on every pixel
+	const AttributeRow row{ GetAttributeRow<typename Pipeline::Varyings>(setup, py) };
+	const int pixelOffset{ py * m_Width };
+
+	int px{ beginX };
+
+	if (m_Settings.isUsingSIMD)
+	{
+		px = RenderSpanSIMD<Pipeline>(setup, row, beginX, endX, pixelOffset);
+	}
+
+	for (; px < endX; ++px)
+	{
+		ShadePixel<Pipeline>(setup, row, px + pixelOffset, static_cast<float>(px - setup.minX));
+	}
+}
+
+void Renderer::RenderSpanDepth(const TriangleSetup& setup, const int py, const int beginX, const int endX, const uint32_t visibilityId)
+{
+	const AttributeRow row{ GetAttributeRow<NoVaryings>(setup, py) };
+	const int pixelOffset{ py * m_Width };
+	const bool isWritingVisibility{ m_RenderPass == RenderPass::Visibility };
+
+	int px{ beginX };
+
+	if (m_Settings.isUsingSIMD)
+	{
+		px = RenderSpanDepthSIMD(setup, row, beginX, endX, pixelOffset, visibilityId);
+	}
+
+	for (; px < endX; ++px)
+	{
+		const float interpolateDepthZ{ row.depthZ + setup.depthZ.stepX * static_cast<float>(px - setup.minX) };
+
+		float& depthBuffer{ m_pDepthBufferPixels[px + pixelOffset] };
+
+		if (depthBuffer < interpolateDepthZ) continue;
+
+		depthBuffer = interpolateDepthZ;
+
+		if (isWritingVisibility) m_pVisibilityBufferPixels[px + pixelOffset] = visibilityId;
+	}
+}
+
+int Renderer::RenderSpanDepthSIMD(const TriangleSetup& setup, const AttributeRow& row, const int beginX, const int endX, const int pixelOffset,
+	const uint32_t visibilityId)
+{
+	using namespace SIMD;
+
+	const Floats rowDepthZ{ Set(row.depthZ) };
+	const Floats stepXDepthZ{ Set(setup.depthZ.stepX) };
+
+	const bool isWritingVisibility{ m_RenderPass == RenderPass::Visibility };
+	const Ints visibilityIds{ Set(visibilityId) };
+
+	const Floats spanEnd{ Set(static_cast<float>(endX - setup.minX)) };
+
+	int px{ beginX };
+
+	for (; px < endX && px + LANE_COUNT <= setup.tileMaxX; px += LANE_COUNT)
+	{
+		const Floats dx{ Add(Set(static_cast<float>(px - setup.minX)), LaneOffsets()) };
+
+		const Floats interpolateDepthZ{ Add(rowDepthZ, Mul(stepXDepthZ, dx)) };
+
+		float* pDepth{ m_pDepthBufferPixels + px + pixelOffset };
+
+		const Floats depthBuffer{ Load(pDepth) };
+		const Floats mask{ And(Greater(spanEnd, dx), NotLess(depthBuffer, interpolateDepthZ)) };
+
+		Store(pDepth, Select(depthBuffer, interpolateDepthZ, mask));
+
+		if (isWritingVisibility)
+		{
+			uint32_t* pVisibility{ m_pVisibilityBufferPixels + px + pixelOffset };
+			Store(pVisibility, Select(Load(pVisibility), visibilityIds, mask));
+		}
+	}
+
+	return px;
+}
+
+template<typename Pipeline>
+void Renderer::ShadePixel(const TriangleSetup& setup, const AttributeRow& row, const int pixelIndex, const float dx)
+{
+	const float interpolateDepthZ{ row.depthZ + setup.depthZ.stepX * dx };
+
+	//After a pre-pass the buffer holds the nearest depth, so this only lets through the pixels that are equal to it
+	if (m_pDepthBufferPixels[pixelIndex] < interpolateDepthZ /*|| interpolateDepthZ < 0 || interpolateDepthZ > 1*/) return;
+
+	if (m_RenderPass != RenderPass::Shade) m_pDepthBufferPixels[pixelIndex] = interpolateDepthZ;
+
+	m_pBackBufferPixels[pixelIndex] = ShadeColor<Pipeline>(setup, row, dx, interpolateDepthZ);
+}
+
+template<typename Pipeline>
+uint32_t Renderer::ShadeColor(const TriangleSetup& setup, const AttributeRow& row, const float dx, const float interpolateDepthZ) const
+{
+	using Varyings = typename Pipeline::Varyings;
+
+	float varyings[std::max(Varyings::COUNT, 1)]{};
+
+	if constexpr (Varyings::COUNT > 0)
+	{
+		//The only division left per pixel, it takes the varyings back out of the 1/w space they are interpolated in
+		const float interpolateDepthW{ 1 / (row.invDepthW + setup.invDepthW.stepX * dx) };
+
+		for (int varyingIndex{}; varyingIndex < Varyings::COUNT; ++varyingIndex)
+		{
+			varyings[varyingIndex] = (row.varyingsOverW[varyingIndex] + setup.varyingsOverW[varyingIndex].stepX * dx) * interpolateDepthW;
+		}
+	}
+
+	return m_PixelPacker.Pack(Pipeline::PixelShader::Shade(varyings, interpolateDepthZ, *m_pTexture));
+}
+
+template<typename Pipeline>
+void Renderer::RenderSpanMultisample(const TriangleSetup& setup, const MultisampleSetup& multisample, const int py, const int beginX, const int endX)
+{
+	using Varyings = typename Pipeline::Varyings;
+
+	const AttributeRow row{ GetAttributeRow<Varyings>(setup, py) };
+
+	//A pixel that is only partly covered gets shaded at its first covered sample, like centroid interpolation,
+	//so its attributes are never extrapolated past the edge of the triangle
+	AttributeRow sampleRows[NR_OF_SAMPLES]{};
+
+	for (int sampleIndex{}; sampleIndex < NR_OF_SAMPLES; ++sampleIndex)
+	{
+		const float offsetY{ m_SamplePositions[sampleIndex][1] / 8.f };
+
+		AttributeRow& sampleRow{ sampleRows[sampleIndex] };
+		sampleRow.depthZ = row.depthZ + setup.depthZ.stepY * offsetY;
+
+		if constexpr (Varyings::COUNT > 0)
+		{
+			sampleRow.invDepthW = row.invDepthW + setup.invDepthW.stepY * offsetY;
+
+			for (int varyingIndex{}; varyingIndex < Varyings::COUNT; ++varyingIndex)
+			{
+				sampleRow.varyingsOverW[varyingIndex] = row.varyingsOverW[varyingIndex] + setup.varyingsOverW[varyingIndex].stepY * offsetY;
+			}
+		}
+	}
+
+	const int fullMask{ (1 << NR_OF_SAMPLES) - 1 };
+
+	const int64_t dy{ py - setup.minY };
+
+	const int64_t rowEdgeV0{ setup.startEdgeV0 + setup.stepYEdgeV0 * dy };
+	const int64_t rowEdgeV1{ setup.startEdgeV1 + setup.stepYEdgeV1 * dy };
+	const int64_t rowEdgeV2{ setup.startEdgeV2 + setup.stepYEdgeV2 * dy };
+
+	for (int px{ beginX }; px < endX; ++px)
+	{
+		const int64_t dx{ px - setup.minX };
+
+		const int64_t edgeV0{ rowEdgeV0 + setup.stepXEdgeV0 * dx };
+		const int64_t edgeV1{ rowEdgeV1 + setup.stepXEdgeV1 * dx };
+		const int64_t edgeV2{ rowEdgeV2 + setup.stepXEdgeV2 * dx };
+
+		const float interpolateDepthZ{ row.depthZ + setup.depthZ.stepX * static_cast<float>(dx) };
+
+		const int pixelIndex{ px + py * m_Width };
+		float* pSampleDepths{ m_pSampleDepthPixels + pixelIndex * NR_OF_SAMPLES };
+
+		//Bit per sample that is covered, and per sample that is covered and in front
+		int coverageMask{};
+		int passMask{};
+
+		for (int sampleIndex{}; sampleIndex < NR_OF_SAMPLES; ++sampleIndex)
+		{
+			if (edgeV0 + multisample.edgeOffsetV0[sampleIndex] < 0) continue;
+			if (edgeV1 + multisample.edgeOffsetV1[sampleIndex] < 0) continue;
+			if (edgeV2 + multisample.edgeOffsetV2[sampleIndex] < 0) continue;
+
+			coverageMask |= 1 << sampleIndex;
+
+			const float sampleDepth{ interpolateDepthZ + multisample.depthOffset[sampleIndex] };
+
+			if (pSampleDepths[sampleIndex] < sampleDepth) continue;
+
+			pSampleDepths[sampleIndex] = sampleDepth;
+			passMask |= 1 << sampleIndex;
+		}
+
+		if (passMask == 0) continue;
+
+		//Shaded once per pixel, whatever samples it covers
+		uint32_t color{};
+
+		if (coverageMask == fullMask)
+		{
+			color = ShadeColor<Pipeline>(setup, row, static_cast<float>(dx), interpolateDepthZ);
+		}
+		else
+		{
+			const int sampleIndex{ std::countr_zero(static_cast<unsigned>(coverageMask)) };
+
+			color = ShadeColor<Pipeline>(setup, sampleRows[sampleIndex], static_cast<float>(dx) + m_SamplePositions[sampleIndex][0] / 8.f,
+				interpolateDepthZ + multisample.depthOffset[sampleIndex]);
+		}
+
+		uint32_t* pSampleColors{ m_pSampleColorPixels + pixelIndex * NR_OF_SAMPLES };
+
+		for (int sampleIndex{}; sampleIndex < NR_OF_SAMPLES; ++sampleIndex)
+		{
+			if (passMask & (1 << sampleIndex)) pSampleColors[sampleIndex] = color;
+		}
+	}
+}
+
+template<typename Pipeline>
+int Renderer::RenderSpanSIMD(const TriangleSetup& setup, const AttributeRow& row, const int beginX, const int endX, const int pixelOffset)
+{
+	using namespace SIMD;
+	using Varyings = typename Pipeline::Varyings;
+
+	const Floats one{ Set(1.f) };
+
+	const Floats rowDepthZ{ Set(row.depthZ) };
+	const Floats stepXDepthZ{ Set(setup.depthZ.stepX) };
+
+	int px{ beginX };
+
+	const Floats spanEnd{ Set(static_cast<float>(endX - setup.minX)) };
+
+	//A group may run past the end of the span, those lanes are masked off and the pixels still belong to this tile
+	//Groups that would cross into the next tile are left to the scalar loop
+	for (; px < endX && px + LANE_COUNT <= setup.tileMaxX; px += LANE_COUNT)
+	{
+		const Floats dx{ Add(Set(static_cast<float>(px - setup.minX)), LaneOffsets()) };
+
+		const Floats interpolateDepthZ{ Add(rowDepthZ, Mul(stepXDepthZ, dx)) };
+
+		const int pixelIndex{ px + pixelOffset };
+
+		const Floats depthBuffer{ Load(m_pDepthBufferPixels + pixelIndex) };
+
+		const Floats mask{ And(Greater(spanEnd, dx), NotLess(depthBuffer, interpolateDepthZ)) };
+
+		const int laneMask{ MoveMask(mask) };
+		if (laneMask == 0) continue;
+
+		if (m_RenderPass != RenderPass::Shade) Store(m_pDepthBufferPixels + pixelIndex, Select(depthBuffer, interpolateDepthZ, mask));
+
+		//Same expressions as ShadeColor
+		Floats varyings[std::max(Varyings::COUNT, 1)]{};
+
+		if constexpr (Varyings::COUNT > 0)
+		{
+			const Floats interpolateDepthW{ Div(one, Add(Set(row.invDepthW), Mul(Set(setup.invDepthW.stepX), dx))) };
+
+			for (int varyingIndex{}; varyingIndex < Varyings::COUNT; ++varyingIndex)
+			{
+				varyings[varyingIndex] = Mul(Add(Set(row.varyingsOverW[varyingIndex]), Mul(Set(setup.varyingsOverW[varyingIndex].stepX), dx)), interpolateDepthW);
+			}
+		}
+
+		Floats red{}, green{}, blue{};
+		Pipeline::PixelShader::Shade(varyings, interpolateDepthZ, laneMask, *m_pTexture, red, green, blue);
+
+		Store(m_pBackBufferPixels + pixelIndex, Select(Load(m_pBackBufferPixels + pixelIndex), m_PixelPacker.Pack(red, green, blue), mask));
+	}
+
+	return px;
+}
+
+bool Renderer::SaveBufferToImage()
+{
+	//Blitting and saving both rewrite the blit map of the surface, so the frame can't be saved while it is being presented
+	//The mutex stays held, a frame queued from another thread meanwhile waits until the save is done
+	std::unique_lock lock{ m_PresentMutex };
+	m_PresentCondition.wait(lock, [this] { return !m_IsBackBufferPresenting[m_BackBufferIndex]; });
+
+	return SDL_SaveBMP(m_pBackBuffer, "Rasterizer_ColorBuffer.bmp");
 }
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <cfloat>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "Camera.h"
 #include "DataTypes.h"
+#include "PixelPacker.h"
+#include "TripleBuffer.h"
+#include "ThreadPool.h"
 
 struct SDL_Window;
 struct SDL_Surface;
@@ -28,10 +35,13 @@ namespace dae
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
+		//Update and Render may run on different threads, Update publishes a snapshot of the scene that the next Render picks up
+		//The toggles belong to the update side, they take effect with the next published snapshot
 		void Update(Timer* pTimer);
 		void Render();
 
-		bool SaveBufferToImage() const;
+		//Render thread only, saves the last rendered frame once the present thread is done with it
+		bool SaveBufferToImage();
 
 		void ToggleCameraLock()
 		{ 
@@ -41,20 +51,61 @@ namespace dae
 			else SDL_SetRelativeMouseMode(SDL_FALSE);
 		}
 
-		void ToggleColorState() { m_IsColoringTexture = !m_IsColoringTexture; }
+		void CycleShadingMode();
+		void ToggleSIMDState() { m_Scene.settings.isUsingSIMD = !m_Scene.settings.isUsingSIMD; }
+		void ToggleFixedPointState() { m_Scene.settings.isUsingFixedPoint = !m_Scene.settings.isUsingFixedPoint; }
+		void ToggleDepthPrePassState() { m_Scene.settings.isUsingDepthPrePass = !m_Scene.settings.isUsingDepthPrePass; }
+		void ToggleVisibilityBufferState() { m_Scene.settings.isUsingVisibilityBuffer = !m_Scene.settings.isUsingVisibilityBuffer; }
+		void ToggleMultisampleState() { m_Scene.settings.isUsingMultisampling = !m_Scene.settings.isUsingMultisampling; }
+		void CycleCullMode();
+
+		//Render thread only, prints how many triangles and meshes of the last frame every culling rule removed
+		void PrintCullStatistics() const;
+		//Render thread only, prints how much of the frame arena the worst frame so far used, and in debug builds how often the last frame hit the heap
+		void PrintMemoryStatistics() const;
 		
 	private:
 		SDL_Window* m_pWindow{};
 
 		SDL_Surface* m_pFrontBuffer{ nullptr };
+		//Back buffer of the frame being rendered, or of the last one when called in between frames
 		SDL_Surface* m_pBackBuffer{ nullptr };
+
+		//Finished frames are blitted and shown on the present thread while the next frame is rasterized
+		//A back buffer is only reused once its frame has been presented, which also bounds how far rendering runs ahead
+		static constexpr int m_NrOfBackBuffers{ 2 };
+
+		SDL_Surface* m_pBackBuffers[m_NrOfBackBuffers]{};
+		bool m_IsBackBufferPresenting[m_NrOfBackBuffers]{};
+		int m_BackBufferIndex{};
+
+		//Ring of back buffer indices waiting to be presented, a buffer is queued at most once so it never holds more than all of them
+		int m_PresentQueue[m_NrOfBackBuffers]{};
+		int m_PresentQueueFront{};
+		int m_NrOfQueuedPresents{};
+		std::mutex m_PresentMutex{};
+		std::condition_variable m_PresentCondition{};
+		bool m_IsStoppingPresent{ false };
+		std::thread m_PresentThread{};
+
+		void AcquireBackBuffer();
+		void QueuePresent();
+		void PresentLoop();
+		//Back buffer format, resolved once at construction
+		PixelPacker m_PixelPacker{};
 		uint32_t* m_pBackBufferPixels{};
 
 		float* m_pDepthBufferPixels{};
 
-		int m_NrOfPixels;
+		//Mesh index in the top bits and triangle index in the rest, written by the visibility pass
+		uint32_t* m_pVisibilityBufferPixels{};
 
-		Camera m_Camera{};
+		//NR_OF_SAMPLES consecutive depths and colors per pixel, only used in multisample mode
+		//Allocated the first time a frame is rendered with multisampling and kept until the renderer is destroyed
+		float* m_pSampleDepthPixels{};
+		uint32_t* m_pSampleColorPixels{};
+
+		void AllocateSampleBuffers();
 
 		Texture* m_pTexture{};
 
@@ -65,31 +116,311 @@ namespace dae
 
 		bool m_IsCamLocked{ true };
 
-		bool m_IsColoringTexture{ true };
+		//Every mode renders through its own Pipeline instantiation, see Shaders.h
+		enum class ShadingMode
+		{
+			Texture,
+			Depth,
+			Normal
+		};
+
+		struct RenderSettings
+		{
+			ShadingMode shadingMode{ ShadingMode::Texture };
+
+			bool isUsingSIMD{ true };
+
+			//Rasterize on an integer subpixel grid with the top-left fill rule instead of in float
+			bool isUsingFixedPoint{ true };
+
+			//Lay down the depth of every mesh first, then shade only the pixels that survived
+			//Every visible pixel is textured once, no matter how much overdraw there is
+			bool isUsingDepthPrePass{ false };
+
+			//Rasterize only depth and triangle ids, then shade every visible pixel once in a resolve pass over the rows
+			//Takes precedence over the depth pre-pass
+			bool isUsingVisibilityBuffer{ false };
+
+			//4x MSAA: coverage and depth per sample, the pixel shader once per pixel, resolved into the back buffer at the end
+			//Takes precedence over the depth pre-pass and the visibility buffer
+			bool isUsingMultisampling{ false };
+		};
+
+		//Everything a frame needs from the update side, published as a whole so a frame never mixes two updates
+		struct SceneSnapshot
+		{
+			Matrix viewMatrix{};
+			Matrix projectionMatrix{};
+			Frustum frustum{};
+			Vector3 cameraOrigin{};
+
+			//One per mesh in m_Meshes_World
+			std::vector<Matrix> worldMatrices{};
+			std::vector<CullMode> cullModes{};
+
+			RenderSettings settings{};
+		};
+
+		//Update side: the camera and the scene as it is being simulated, only touched by Update and the toggles
+		Camera m_Camera{};
+		SceneSnapshot m_Scene{};
+
+		TripleBuffer<SceneSnapshot> m_SceneSnapshots{};
+
+		void PublishScene();
+
+		//Render side: the settings and camera of the snapshot the current frame was started with
+		RenderSettings m_Settings{};
+		Matrix m_ViewMatrix{};
+		Matrix m_ProjectionMatrix{};
+		Frustum m_Frustum{};
+		Vector3 m_CameraOrigin{};
+
+		void ApplyScene();
+
+		//Rotated grid around the sample point of the pixel, in eighths of a pixel
+		static constexpr int m_SamplePositions[NR_OF_SAMPLES][2]{ { -1, -3 }, { 3, -1 }, { -3, 1 }, { 1, 3 } };
+
+		enum class RenderPass
+		{
+			Combined,
+			DepthOnly,
+			Shade,
+			Visibility,
+			Multisample
+		};
+
+		static constexpr int m_TriangleIdBits{ 24 };
+		static constexpr uint32_t m_TriangleIdMask{ (1u << m_TriangleIdBits) - 1 };
+		static constexpr uint32_t m_EmptyVisibilityId{ UINT32_MAX };
+
+		//Meshes and triangles per mesh a visibility id can tell apart
+		//The highest triangle id is never handed out, so no id of the last mesh can equal m_EmptyVisibilityId
+		static constexpr uint32_t m_MaxVisibilityMeshes{ 1u << (32 - m_TriangleIdBits) };
+		static constexpr uint32_t m_MaxVisibilityTriangles{ m_TriangleIdMask };
+
+		//Clipping turns a triangle into a polygon of at most 3 + 6 vertices, which is fanned into at most 7 triangles
+		static constexpr uint32_t m_MaxClippedTriangles{ 7 };
+
+		//Decided when the scene is loaded, a scene too big for the ids renders with the forward path even with the visibility buffer toggled on
+		bool m_IsVisibilityBufferSupported{};
+
+		//What the resolve pass needs of a mesh after the next mesh reused the bins and screen space vertices
+		struct VisibilityMesh
+		{
+			FrameArray<Triangle> triangles{};
+			FrameArray<Vector2> verticesScreenSpace{};
+		};
+
+		std::vector<VisibilityMesh> m_VisibilityMeshes{};
+		uint32_t m_MeshIndex{};
+
+		//Pass the tiles are currently rasterizing, set before they are handed to the thread pool
+		RenderPass m_RenderPass{ RenderPass::Combined };
+
+		static constexpr int m_SubpixelBits{ 8 };
 
 		const float m_RotateSpeed{ 25.f };
 
+		//Screen is split in square tiles, triangles are binned per tile and every tile is rasterized on its own thread
+		static constexpr int m_TileSize{ 64 };
+
+		int m_NrOfTilesX{};
+		int m_NrOfTilesY{};
+
+		std::vector<Tile> m_Tiles{};
+		FrameArray<Triangle> m_Triangles{};
+
+		//Room for the triangles a tile gets from one mesh, bins grow beyond it when they need to
+		static constexpr size_t m_InitialBinCapacity{ 256 };
+
+		ThreadPool m_ThreadPool{};
+
+		//Transformed vertices, triangles and bins of the current frame, all released at once when the next frame starts
+		FrameArena m_FrameArena{};
+
+		//Heap allocations the render thread and the thread pool made during the last frame, only counted in debug builds
+		uint64_t m_NrOfFrameAllocations{};
+
 		//Function that transforms the vertices from the mesh from World space to Screen space
+		template<typename VertexShader>
 		void VertexTransformationFunction(Mesh& mesh); //W1 Version
+		//Clip space, NDC and screen space positions of the vertices [beginIndex, endIndex), a SIMD group of vertices at a time
+		//beginIndex has to be a multiple of SIMD::LANE_COUNT
+		void TransformPositions(Mesh& mesh, const Matrix& worldViewProjectionMatrix, const size_t beginIndex, const size_t endIndex);
+
+		//Vertices are transformed in chunks of this many on the thread pool, a whole number of SIMD groups
+		static constexpr size_t m_VertexChunkSize{ 1024 };
+
+		void InitializeTiles();
+
+		//Runs every pass of one frame with the given pipeline
+		template<typename Pipeline>
+		void RenderFrame();
+
+		//Transforms, bins and rasterizes every mesh in the current render pass
+		template<typename Pipeline>
+		void RenderMeshes();
+
+		//Rebuilds the setup of the triangle stored in every pixel of the row and shades it
+		template<typename Pipeline>
+		void ResolveVisibilityRow(const int py);
+
+		//Averages the samples of every pixel in the row into the back buffer
+		void ResolveSamplesRow(const int py);
 
-		Vector2 CalcUVComponent(const float weight, const float depth, const size_t index, const Mesh& mesh) const;
+		//Sets up every visible triangle of the mesh and adds it to the bin of each tile its bounding box touches
+		void BinTriangles(Mesh& mesh);
+		void SetupTriangle(const size_t idx, Mesh& mesh, const bool swapVertices);
+		void BinTriangle(uint32_t index0, uint32_t index1, uint32_t index2, const CullMode cullMode);
 
-		void RenderTriangle(const size_t idx, const Mesh& mesh, const bool swapVertices);
+		//Triangles whose doubled screen area is below one subpixel squared can't reliably cover a sample
+		static constexpr float m_MinTriangleArea{ 1.f / ((1 << m_SubpixelBits) * (1 << m_SubpixelBits)) };
 
-		void ClearBackGround() const
+		//Culling counters, reset every frame
+		uint32_t m_NrOfZeroAreaCulled{};
+		uint32_t m_NrOfBackFacesCulled{};
+		uint32_t m_NrOfFrontFacesCulled{};
+		uint32_t m_NrOfMeshesCulled{};
+		uint32_t m_NrOfMeshletsCulled{};
+		uint32_t m_NrOfMeshletsFacingAway{};
+
+		//The mesh or meshlet being set up lies completely inside the frustum, its triangles need no outcodes or clipping
+		bool m_IsInsideFrustum{};
+
+		struct VisibleMeshlet
 		{
-			SDL_FillRect(m_pBackBuffer, NULL, SDL_MapRGB(m_pBackBuffer->format, 100, 100, 100));
-		}
+			uint32_t meshletIndex{};
+			bool isInsideFrustum{};
+		};
+
+		//Meshlets of the current mesh that survived culling, in index buffer order
+		FrameArray<VisibleMeshlet> m_VisibleMeshlets{};
+
+		//Drops the meshlets outside the frustum and those whose triangles all face the culled way
+		void CullMeshlets(const Mesh& mesh, const bool isMeshInsideFrustum);
 
-		void constexpr ClearDepthBuffer()
+		//True when, for every point in the sphere and every normal in the cone, the triangle faces away from the eye
+		static bool IsConeFacingAway(const Vector3& center, const float radius, const Vector3& axis, const float coneCos, const float coneSin, const Vector3& eye);
+
+		struct VertexRange
 		{
-			std::fill_n(m_pDepthBufferPixels, m_NrOfPixels, FLT_MAX);
-		}
+			size_t beginIndex{};
+			size_t endIndex{};
+		};
+
+		//Ranges of at most m_VertexChunkSize vertices covering every vertex a visible meshlet uses, each a whole number of SIMD groups
+		FrameArray<VertexRange> GetVertexChunks(const Mesh& mesh);
+
+		//Triangles are only clipped when they cross the near or far plane or leave the guard band
+		//The guard band is expressed in NDC, 4 means everything up to 4 screen widths away is rasterized as is
+		static constexpr float m_GuardBand{ 4.f };
+
+		enum ClipPlane : uint8_t
+		{
+			ClipPlaneLeft = 1 << 0,
+			ClipPlaneRight = 1 << 1,
+			ClipPlaneBottom = 1 << 2,
+			ClipPlaneTop = 1 << 3,
+			ClipPlaneNear = 1 << 4,
+			ClipPlaneFar = 1 << 5
+		};
+
+		uint8_t ComputeOutcode(const Vector4& clip, const float guardBand) const;
+		void ClipTriangle(Mesh& mesh, const uint32_t index0, const uint32_t index1, const uint32_t index2, const uint8_t planes);
+		Vertex_Out LerpVertex(const Vertex_Out& v0, const Vertex_Out& v1, const float t) const;
+		uint32_t AddClippedVertex(Mesh& mesh, Vertex_Out vertex);
+
+		Vector2 ToScreenSpace(const Vector4& ndc) const;
+
+		template<typename Pipeline>
+		void RenderTile(Tile& tile, const Mesh& mesh);
+		template<typename Pipeline>
+		void RenderTriangle(const uint32_t triangleIndex, const Mesh& mesh, Tile& tile);
+
+		//Only touch the part of the triangle that lies inside this tile
+		void ClampToTile(TriangleSetup& setup, const Triangle& triangle, const Tile& tile) const;
+
+		//Edge functions plus the vertex attributes to interpolate, returns false when the triangle has no positive area
+		template<typename Varyings>
+		bool SetupInterpolation(TriangleSetup& setup, const Triangle& triangle, const Mesh& mesh, const FrameArray<Vector2>& verticesScreenSpace) const;
+		AttributePlane SetupPlane(const TriangleSetup& setup, const float valueV0, const float valueV1, const float valueV2) const;
+		template<typename Varyings>
+		AttributeRow GetAttributeRow(const TriangleSetup& setup, const int py) const;
+
+		//Hierarchical depth: the farthest depth of every block of m_DepthBlockSize pixels squared, and of every tile
+		//A stored value is never nearer than the pixels it covers: depth writes only ever bring pixels nearer, so it stays a safe bound
+		//Writes mark a block dirty, dirty blocks are rescanned once when their tile is refreshed after a mesh and that clears the flag
+		//Queries in between use the stored value as is, never rescanning
+		static constexpr int m_DepthBlockSize{ 8 };
+
+		//A triangle is only rejected when its nearest vertex is this much behind the blocks it covers
+		//The planes the span kernels step along can land a few ulps nearer than every vertex, depths are at most 1 so this is 64 ulps or more
+		static constexpr float m_DepthRejectBias{ 64 * FLT_EPSILON };
+
+		//Sized once in InitializeTiles, a frame only resets them
+		int m_NrOfDepthBlocksX{};
+		std::vector<float> m_DepthBlockMax{};
+		std::vector<uint8_t> m_IsDepthBlockDirty{};
+
+		void ClearHierarchicalDepth();
+
+		//Farthest depth of the pixel rectangle [minX, maxX) x [minY, maxY), rounded out to whole blocks
+		float GetMaxDepth(const int minX, const int minY, const int maxX, const int maxY) const;
+		//Rescans the dirty blocks of the rectangle once, after which their stored maximum is exact again
+		void RefreshDepthBlocks(const int minX, const int minY, const int maxX, const int maxY);
+		void RefreshBlockMaxDepth(const int blockX, const int blockY);
+		//A triangle whose depth plane is not finite may write NaN, which lets every later pixel through, so its blocks open up right away
+		void MarkDepthDirty(const int minX, const int minY, const int maxX, const int maxY, const bool isDepthFinite);
+
+		//Fill in the edge functions of the setup, return false when the triangle has no positive area
+		bool SetupEdges(TriangleSetup& setup, const Vector2& v0, const Vector2& v1, const Vector2& v2) const;
+		bool SetupEdgesFixed(TriangleSetup& setup, const Vector2& v0, const Vector2& v1, const Vector2& v2) const;
+
+		//Shrinks [beginX, endX) to the pixels of row py that lie inside all three edges
+		void ClipSpan(const TriangleSetup& setup, const int py, int& beginX, int& endX) const;
+		void ClipSpanFixed(const TriangleSetup& setup, const int py, int& beginX, int& endX) const;
+		void ClipSpanFixed(const TriangleSetup& setup, const int py, int& beginX, int& endX,
+			const int64_t edgeOffsetV0, const int64_t edgeOffsetV1, const int64_t edgeOffsetV2) const;
+
+		//Shrinks [beginX, endX) to the pixels of row py with at least one covered sample
+		void ClipSpanMultisample(const TriangleSetup& setup, const MultisampleSetup& multisample, const int py, int& beginX, int& endX) const;
+		MultisampleSetup SetupMultisample(const TriangleSetup& setup) const;
+
+		//Rasterizes the pixels [beginX, endX) of row py, they must all be covered by the triangle
+		template<typename Pipeline>
+		void RenderSpan(const TriangleSetup& setup, const int py, const int beginX, const int endX);
+		template<typename Pipeline>
+		void ShadePixel(const TriangleSetup& setup, const AttributeRow& row, const int pixelIndex, const float dx);
+		//Runs the pixel shader and packs the result in the back buffer format
+		template<typename Pipeline>
+		uint32_t ShadeColor(const TriangleSetup& setup, const AttributeRow& row, const float dx, const float interpolateDepthZ) const;
+
+		//Tests coverage and depth of every sample of the pixels [beginX, endX) of row py, and shades each pixel once when any sample passes
+		template<typename Pipeline>
+		void RenderSpanMultisample(const TriangleSetup& setup, const MultisampleSetup& multisample, const int py, const int beginX, const int endX);
+
+		//Stripped down RenderSpan for the depth pre-pass, only interpolates depth and writes the depth buffer
+		//In the visibility pass it also stores visibilityId for the pixels that pass
+		void RenderSpanDepth(const TriangleSetup& setup, const int py, const int beginX, const int endX, const uint32_t visibilityId);
+		int RenderSpanDepthSIMD(const TriangleSetup& setup, const AttributeRow& row, const int beginX, const int endX, const int pixelOffset,
+			const uint32_t visibilityId);
+
+		//Vectorized version of RenderSpan, handles whole groups of SIMD::LANE_COUNT pixels
+		//Returns the first pixel it did not handle, the scalar loop picks up from there
+		template<typename Pipeline>
+		int RenderSpanSIMD(const TriangleSetup& setup, const AttributeRow& row, const int beginX, const int endX, const int pixelOffset);
+
+		//The buffers are cleared per tile, the first time a tile gets triangles in a frame
+		//Tiles nothing was drawn to are only filled with the background color right before the frame is presented
+		uint32_t m_BackgroundColor{};
 
-		bool IsOutOfFrustrum(const Vertex_Out& vOUT) const;
+		void ClearTile(Tile& tile);
+		void FillUntouchedTiles();
 
 		//std::vector<Vertex> m_Vertices_NDC{};
-		std::vector<Vector2> m_Vertices_ScreenSpace{};
+		FrameArray<Vector2> m_Vertices_ScreenSpace{};
+		FrameArray<Vector4> m_Vertices_ClipSpace{};
 
 		//define mesh
 		/*const std::vector<Mesh> meshesWorld
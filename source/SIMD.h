@@ -0,0 +1,129 @@
+#pragma once
+#include <immintrin.h>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+//Thin wrappers over the widest vector registers the build targets
+//Both x64 configurations of the project build with /arch:AVX2 and get 8 lanes, a build without it falls back to 4 SSE4.1 lanes
+//All operations map onto exactly one IEEE instruction, so lane results are bit identical to the scalar code doing the same math
+
+namespace dae
+{
+	namespace SIMD
+	{
+#if defined(__AVX2__)
+		constexpr int LANE_COUNT{ 8 };
+
+		using Floats = __m256;
+		using Ints = __m256i;
+
+		inline Floats Set(float value) { return _mm256_set1_ps(value); }
+		inline Floats LaneOffsets() { return _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f); }
+		inline Floats Load(const float* pData) { return _mm256_loadu_ps(pData); }
+		//pData must be aligned to sizeof(Floats), a misaligned pointer faults instead of silently loading slower
+		inline Floats LoadAligned(const float* pData) { return _mm256_load_ps(pData); }
+		inline void Store(float* pData, Floats value) { _mm256_storeu_ps(pData, value); }
+		inline void StoreAligned(float* pData, Floats value) { _mm256_store_ps(pData, value); }
+
+		inline Floats Add(Floats a, Floats b) { return _mm256_add_ps(a, b); }
+		inline Floats Sub(Floats a, Floats b) { return _mm256_sub_ps(a, b); }
+		inline Floats Mul(Floats a, Floats b) { return _mm256_mul_ps(a, b); }
+		inline Floats Div(Floats a, Floats b) { return _mm256_div_ps(a, b); }
+		inline Floats Min(Floats a, Floats b) { return _mm256_min_ps(a, b); }
+		inline Floats Max(Floats a, Floats b) { return _mm256_max_ps(a, b); }
+		inline Floats Sqrt(Floats value) { return _mm256_sqrt_ps(value); }
+
+		//Lane is set when !(a < b), the exact opposite of the scalar 'if (a < b) continue;' including NaN
+		inline Floats NotLess(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_NLT_UQ); }
+		inline Floats Greater(Floats a, Floats b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+		inline Floats And(Floats a, Floats b) { return _mm256_and_ps(a, b); }
+		inline int MoveMask(Floats mask) { return _mm256_movemask_ps(mask); }
+
+		//Picks b in the lanes where mask is set
+		inline Floats Select(Floats a, Floats b, Floats mask) { return _mm256_blendv_ps(a, b, mask); }
+		inline Ints Select(Ints a, Ints b, Floats mask) { return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), mask)); }
+
+		inline Ints Set(uint32_t value) { return _mm256_set1_epi32(static_cast<int>(value)); }
+		inline Ints Load(const uint32_t* pData) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pData)); }
+		inline void Store(uint32_t* pData, Ints value) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(pData), value); }
+		//Non-temporal store past the caches, pData must be aligned to sizeof(Ints)
+		inline void Stream(uint32_t* pData, Ints value) { _mm256_stream_si256(reinterpret_cast<__m256i*>(pData), value); }
+
+		inline Ints TruncateToInt(Floats value) { return _mm256_cvttps_epi32(value); }
+		inline Ints Or(Ints a, Ints b) { return _mm256_or_si256(a, b); }
+		inline Ints ShiftLeft(Ints value, int count) { return _mm256_sll_epi32(value, _mm_cvtsi32_si128(count)); }
+		inline Ints ShiftRight(Ints value, int count) { return _mm256_srl_epi32(value, _mm_cvtsi32_si128(count)); }
+#else
+		constexpr int LANE_COUNT{ 4 };
+
+		using Floats = __m128;
+		using Ints = __m128i;
+
+		inline Floats Set(float value) { return _mm_set1_ps(value); }
+		inline Floats LaneOffsets() { return _mm_setr_ps(0.f, 1.f, 2.f, 3.f); }
+		inline Floats Load(const float* pData) { return _mm_loadu_ps(pData); }
+		//pData must be aligned to sizeof(Floats), a misaligned pointer faults instead of silently loading slower
+		inline Floats LoadAligned(const float* pData) { return _mm_load_ps(pData); }
+		inline void Store(float* pData, Floats value) { _mm_storeu_ps(pData, value); }
+		inline void StoreAligned(float* pData, Floats value) { _mm_store_ps(pData, value); }
+
+		inline Floats Add(Floats a, Floats b) { return _mm_add_ps(a, b); }
+		inline Floats Sub(Floats a, Floats b) { return _mm_sub_ps(a, b); }
+		inline Floats Mul(Floats a, Floats b) { return _mm_mul_ps(a, b); }
+		inline Floats Div(Floats a, Floats b) { return _mm_div_ps(a, b); }
+		inline Floats Min(Floats a, Floats b) { return _mm_min_ps(a, b); }
+		inline Floats Max(Floats a, Floats b) { return _mm_max_ps(a, b); }
+		inline Floats Sqrt(Floats value) { return _mm_sqrt_ps(value); }
+
+		//Lane is set when !(a < b), the exact opposite of the scalar 'if (a < b) continue;' including NaN
+		inline Floats NotLess(Floats a, Floats b) { return _mm_cmpnlt_ps(a, b); }
+		inline Floats Greater(Floats a, Floats b) { return _mm_cmpgt_ps(a, b); }
+		inline Floats And(Floats a, Floats b) { return _mm_and_ps(a, b); }
+		inline int MoveMask(Floats mask) { return _mm_movemask_ps(mask); }
+
+		//Picks b in the lanes where mask is set
+		inline Floats Select(Floats a, Floats b, Floats mask) { return _mm_blendv_ps(a, b, mask); }
+		inline Ints Select(Ints a, Ints b, Floats mask) { return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), mask)); }
+
+		inline Ints Set(uint32_t value) { return _mm_set1_epi32(static_cast<int>(value)); }
+		inline Ints Load(const uint32_t* pData) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pData)); }
+		inline void Store(uint32_t* pData, Ints value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(pData), value); }
+		//Non-temporal store past the caches, pData must be aligned to sizeof(Ints)
+		inline void Stream(uint32_t* pData, Ints value) { _mm_stream_si128(reinterpret_cast<__m128i*>(pData), value); }
+
+		inline Ints TruncateToInt(Floats value) { return _mm_cvttps_epi32(value); }
+		inline Ints Or(Ints a, Ints b) { return _mm_or_si128(a, b); }
+		inline Ints ShiftLeft(Ints value, int count) { return _mm_sll_epi32(value, _mm_cvtsi32_si128(count)); }
+		inline Ints ShiftRight(Ints value, int count) { return _mm_srl_epi32(value, _mm_cvtsi32_si128(count)); }
+#endif
+
+		//Streaming stores are weakly ordered, this makes them visible before anything stored after it
+		inline void StreamFence() { _mm_sfence(); }
+
+		//Enough for the widest registers of either build, so the same data works with LoadAligned in both
+		constexpr size_t ALIGNMENT{ 32 };
+		static_assert(sizeof(Floats) <= ALIGNMENT);
+
+		//std::vector storage that starts on an ALIGNMENT boundary, for streams that are read a whole group at a time
+		template<typename T>
+		struct AlignedAllocator
+		{
+			using value_type = T;
+
+			AlignedAllocator() = default;
+			template<typename U>
+			AlignedAllocator(const AlignedAllocator<U>&) noexcept {}
+
+			T* allocate(size_t count) { return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{ ALIGNMENT })); }
+			void deallocate(T* pData, size_t) noexcept { ::operator delete(pData, std::align_val_t{ ALIGNMENT }); }
+
+			template<typename U>
+			bool operator==(const AlignedAllocator<U>&) const noexcept { return true; }
+		};
+
+		template<typename T>
+		using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+	}
+}
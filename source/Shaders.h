@@ -0,0 +1,191 @@
+#pragma once
+#include <cmath>
+
+#include "DataTypes.h"
+#include "MathHelpers.h"
+#include "SIMD.h"
+#include "Texture.h"
+
+//Compile time building blocks of the render pipelines
+//Every render mode is one Pipeline instantiation, the pixel loops of the renderer are templated on it,
+//so each mode gets its own inner loop without branches on the mode or virtual calls
+
+namespace dae
+{
+	//---------- Varying layouts ----------
+	//How many floats every transformed vertex carries on top of its position, one plane per varying is set up and evaluated
+	//Transformed vertices hold exactly this many, so a pipeline that interpolates less also transforms and stores less
+
+	struct NoVaryings
+	{
+		static constexpr int COUNT{ 0 };
+	};
+
+	//u, v
+	struct UVVaryings
+	{
+		static constexpr int COUNT{ 2 };
+	};
+
+	//World space normal x, y, z
+	struct NormalVaryings
+	{
+		static constexpr int COUNT{ 3 };
+	};
+
+	//---------- Vertex shaders ----------
+	//Write the varyings of one vertex, laid out as the Varyings of the shader declare
+	//Positions are the same for every pipeline, the renderer transforms those a SIMD group at a time
+
+	struct PositionOnlyVertexShader
+	{
+		using Varyings = NoVaryings;
+
+		static void Transform(const Vertex& /*vertex*/, const Matrix& /*worldMatrix*/, float* /*pVaryings*/) {}
+	};
+
+	struct TexCoordVertexShader
+	{
+		using Varyings = UVVaryings;
+
+		static void Transform(const Vertex& vertex, const Matrix& /*worldMatrix*/, float* pVaryings)
+		{
+			pVaryings[0] = vertex.uv.x;
+			pVaryings[1] = vertex.uv.y;
+		}
+	};
+
+	struct WorldNormalVertexShader
+	{
+		using Varyings = NormalVaryings;
+
+		static void Transform(const Vertex& vertex, const Matrix& worldMatrix, float* pVaryings)
+		{
+			const Vector3 normal{ worldMatrix.TransformVector(vertex.normal) };
+
+			pVaryings[0] = normal.x;
+			pVaryings[1] = normal.y;
+			pVaryings[2] = normal.z;
+		}
+	};
+
+	//---------- Pixel shaders ----------
+	//A scalar and a vectorized Shade with the same order of operations, so both kernels write the same colors
+	//The vectorized one only has to produce valid colors in the lanes of laneMask
+
+	struct TexturePixelShader
+	{
+		static ColorRGB Shade(const float* pVaryings, const float /*depthZ*/, const Texture& texture)
+		{
+			return texture.Sample({ pVaryings[0], pVaryings[1] });
+		}
+
+		static void Shade(const SIMD::Floats* pVaryings, const SIMD::Floats /*depthZ*/, const int laneMask, const Texture& texture,
+			SIMD::Floats& red, SIMD::Floats& green, SIMD::Floats& blue)
+		{
+			using namespace SIMD;
+
+			//Texture fetches stay scalar, only for the lanes that passed
+			alignas(32) float uLanes[LANE_COUNT]{}, vLanes[LANE_COUNT]{};
+			alignas(32) float redLanes[LANE_COUNT]{}, greenLanes[LANE_COUNT]{}, blueLanes[LANE_COUNT]{};
+
+			Store(uLanes, pVaryings[0]);
+			Store(vLanes, pVaryings[1]);
+
+			for (int lane{}; lane < LANE_COUNT; ++lane)
+			{
+				if (!(laneMask & (1 << lane))) continue;
+
+				const ColorRGB sample{ texture.Sample({ uLanes[lane], vLanes[lane] }) };
+
+				redLanes[lane] = sample.r;
+				greenLanes[lane] = sample.g;
+				blueLanes[lane] = sample.b;
+			}
+
+			red = Load(redLanes);
+			green = Load(greenLanes);
+			blue = Load(blueLanes);
+		}
+	};
+
+	struct DepthPixelShader
+	{
+		static constexpr float MIN_DEPTH{ 0.985f };
+		static constexpr float MAX_DEPTH{ 1.0f };
+
+		static ColorRGB Shade(const float* /*pVaryings*/, const float depthZ, const Texture& /*texture*/)
+		{
+			const float colorDepth{ Remap(depthZ, MIN_DEPTH, MAX_DEPTH) };
+
+			return { colorDepth, colorDepth, colorDepth };
+		}
+
+		static void Shade(const SIMD::Floats* /*pVaryings*/, const SIMD::Floats depthZ, const int /*laneMask*/, const Texture& /*texture*/,
+			SIMD::Floats& red, SIMD::Floats& green, SIMD::Floats& blue)
+		{
+			using namespace SIMD;
+
+			//Remap: std::clamp followed by (depth - min) / (max - min)
+			const Floats minDepth{ Set(MIN_DEPTH) };
+			const Floats maxDepth{ Set(MAX_DEPTH) };
+
+			const Floats clamped{ Max(minDepth, Min(maxDepth, depthZ)) };
+			const Floats colorDepth{ Div(Sub(clamped, minDepth), Sub(maxDepth, minDepth)) };
+
+			red = colorDepth;
+			green = colorDepth;
+			blue = colorDepth;
+		}
+	};
+
+	//Maps the world space normal from [-1, 1] to a color in [0, 1]
+	struct NormalPixelShader
+	{
+		static ColorRGB Shade(const float* pVaryings, const float /*depthZ*/, const Texture& /*texture*/)
+		{
+			const float length{ std::sqrt(pVaryings[0] * pVaryings[0] + pVaryings[1] * pVaryings[1] + pVaryings[2] * pVaryings[2]) };
+
+			return
+			{
+				pVaryings[0] / length * 0.5f + 0.5f,
+				pVaryings[1] / length * 0.5f + 0.5f,
+				pVaryings[2] / length * 0.5f + 0.5f
+			};
+		}
+
+		static void Shade(const SIMD::Floats* pVaryings, const SIMD::Floats /*depthZ*/, const int /*laneMask*/, const Texture& /*texture*/,
+			SIMD::Floats& red, SIMD::Floats& green, SIMD::Floats& blue)
+		{
+			using namespace SIMD;
+
+			const Floats half{ Set(0.5f) };
+
+			const Floats length
+			{
+				Sqrt(Add(Add(Mul(pVaryings[0], pVaryings[0]), Mul(pVaryings[1], pVaryings[1])), Mul(pVaryings[2], pVaryings[2])))
+			};
+
+			red = Add(Mul(Div(pVaryings[0], length), half), half);
+			green = Add(Mul(Div(pVaryings[1], length), half), half);
+			blue = Add(Mul(Div(pVaryings[2], length), half), half);
+		}
+	};
+
+	//---------- Pipelines ----------
+
+	//The vertex shader decides the varyings, the pixel shader reads them in the same layout
+	template<typename VertexShaderType, typename PixelShaderType>
+	struct Pipeline
+	{
+		using VertexShader = VertexShaderType;
+		using Varyings = typename VertexShader::Varyings;
+		using PixelShader = PixelShaderType;
+
+		static_assert(Varyings::COUNT <= MAX_VARYINGS, "TriangleSetup has no room for this many varyings");
+	};
+
+	using TexturePipeline = Pipeline<TexCoordVertexShader, TexturePixelShader>;
+	using DepthPipeline = Pipeline<PositionOnlyVertexShader, DepthPixelShader>;
+	using NormalPipeline = Pipeline<WorldNormalVertexShader, NormalPixelShader>;
+}
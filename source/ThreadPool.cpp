@@ -0,0 +1,148 @@
+#include "ThreadPool.h"
+#include "AllocationCounter.h"
+
+#include <algorithm>
+
+using namespace dae;
+
+ThreadPool::ThreadPool(uint32_t nrOfThreads)
+{
+	nrOfThreads = std::max(nrOfThreads, 1u);
+
+	for (uint32_t queueIndex{}; queueIndex < nrOfThreads; ++queueIndex)
+	{
+		m_Queues.emplace_back(std::make_unique<WorkQueue>());
+	}
+
+	//Queue 0 belongs to the thread that calls ParallelFor
+	for (uint32_t queueIndex{ 1 }; queueIndex < nrOfThreads; ++queueIndex)
+	{
+		m_Workers.emplace_back(&ThreadPool::WorkerLoop, this, queueIndex);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock{ m_Mutex };
+		m_IsStopping = true;
+	}
+
+	m_WakeCondition.notify_all();
+
+	for (std::thread& worker : m_Workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::ParallelFor(uint32_t count, InvokeTask pInvokeTask, const void* pTask)
+{
+	if (count == 0) return;
+
+	m_pTask = pTask;
+	m_pInvokeTask = pInvokeTask;
+	m_NrOfPendingTasks = count;
+
+	//Every thread starts on its own contiguous range, so neighbouring work items stay on the same core
+	const uint32_t nrOfQueues{ GetNrOfThreads() };
+
+	for (uint32_t queueIndex{}; queueIndex < nrOfQueues; ++queueIndex)
+	{
+		const uint32_t begin{ static_cast<uint32_t>(uint64_t(count) * queueIndex / nrOfQueues) };
+		const uint32_t end{ static_cast<uint32_t>(uint64_t(count) * (queueIndex + 1) / nrOfQueues) };
+
+		m_Queues[queueIndex]->range.store(PackRange(begin, end));
+	}
+
+	{
+		std::lock_guard lock{ m_Mutex };
+		++m_Generation;
+	}
+
+	m_WakeCondition.notify_all();
+
+	RunTasks(0);
+
+	std::unique_lock lock{ m_Mutex };
+	m_DoneCondition.wait(lock, [this] { return m_NrOfPendingTasks == 0; });
+}
+
+void ThreadPool::WorkerLoop(uint32_t queueIndex)
+{
+	AllocationCounter::TrackCurrentThread();
+
+	uint64_t seenGeneration{};
+
+	while (true)
+	{
+		{
+			std::unique_lock lock{ m_Mutex };
+			m_WakeCondition.wait(lock, [&] { return m_IsStopping || m_Generation != seenGeneration; });
+
+			if (m_IsStopping) return;
+
+			seenGeneration = m_Generation;
+		}
+
+		RunTasks(queueIndex);
+	}
+}
+
+void ThreadPool::RunTasks(uint32_t queueIndex)
+{
+	uint32_t index{};
+
+	while (PopOrSteal(queueIndex, index))
+	{
+		m_pInvokeTask(m_pTask, index);
+
+		if (m_NrOfPendingTasks.fetch_sub(1) == 1)
+		{
+			std::lock_guard lock{ m_Mutex };
+			m_DoneCondition.notify_all();
+		}
+	}
+}
+
+bool ThreadPool::PopOrSteal(uint32_t queueIndex, uint32_t& index)
+{
+	const uint32_t nrOfQueues{ GetNrOfThreads() };
+
+	//Own queue first, front to back
+	{
+		std::atomic<uint64_t>& range{ m_Queues[queueIndex]->range };
+		uint64_t current{ range.load() };
+
+		while (static_cast<uint32_t>(current) < static_cast<uint32_t>(current >> 32))
+		{
+			const uint32_t begin{ static_cast<uint32_t>(current) };
+
+			if (range.compare_exchange_weak(current, PackRange(begin + 1, static_cast<uint32_t>(current >> 32))))
+			{
+				index = begin;
+				return true;
+			}
+		}
+	}
+
+	//Steal from the back of the other queues, furthest away from where their owner is working
+	for (uint32_t offset{ 1 }; offset < nrOfQueues; ++offset)
+	{
+		std::atomic<uint64_t>& range{ m_Queues[(queueIndex + offset) % nrOfQueues]->range };
+		uint64_t current{ range.load() };
+
+		while (static_cast<uint32_t>(current) < static_cast<uint32_t>(current >> 32))
+		{
+			const uint32_t end{ static_cast<uint32_t>(current >> 32) };
+
+			if (range.compare_exchange_weak(current, PackRange(static_cast<uint32_t>(current), end - 1)))
+			{
+				index = end - 1;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
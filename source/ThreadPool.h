@@ -0,0 +1,71 @@
+#pragma once
+
+//Standard includes
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	class ThreadPool final
+	{
+	public:
+		//Creates one worker less than there are hardware threads, the thread calling ParallelFor is the last one
+		ThreadPool(uint32_t nrOfThreads = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		//Runs task(index) for every index in [0, count) and blocks until all of them are done
+		//Indices are dealt out over per-thread queues, a thread that runs dry steals from the back of the others
+		//The queues are ranges of indices, so handing out work never touches the heap
+		//The task is only referenced, not copied into a std::function, so no capture ever ends up on the heap
+		template<typename Task>
+		void ParallelFor(uint32_t count, const Task& task)
+		{
+			ParallelFor(count, [](const void* pTask, uint32_t index) { (*static_cast<const Task*>(pTask))(index); }, &task);
+		}
+
+		uint32_t GetNrOfThreads() const { return static_cast<uint32_t>(m_Queues.size()); }
+
+	private:
+		//Indices [begin, end) still to run, begin in the low and end in the high 32 bits
+		//The owner takes from the front and thieves from the back, both with a compare exchange on the whole range
+		//Each queue gets its own cache line, the owners update theirs all the time
+		struct alignas(64) WorkQueue
+		{
+			std::atomic<uint64_t> range{};
+		};
+
+		static uint64_t PackRange(uint32_t begin, uint32_t end) { return (uint64_t(end) << 32) | begin; }
+
+		std::vector<std::thread> m_Workers{};
+		std::vector<std::unique_ptr<WorkQueue>> m_Queues{};
+
+		using InvokeTask = void(*)(const void* pTask, uint32_t index);
+
+		const void* m_pTask{ nullptr };
+		InvokeTask m_pInvokeTask{ nullptr };
+
+		std::mutex m_Mutex{};
+		std::condition_variable m_WakeCondition{};
+		std::condition_variable m_DoneCondition{};
+
+		std::atomic<uint32_t> m_NrOfPendingTasks{};
+		uint64_t m_Generation{};
+		bool m_IsStopping{ false };
+
+		void ParallelFor(uint32_t count, InvokeTask pInvokeTask, const void* pTask);
+
+		void WorkerLoop(uint32_t queueIndex);
+		void RunTasks(uint32_t queueIndex);
+		bool PopOrSteal(uint32_t queueIndex, uint32_t& index);
+	};
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+//Hands complete values from one writer thread to one reader thread without locks
+//Writer and reader each own one of the three buffers, the third one is swapped in and out atomically
+//The writer never waits for the reader and the reader always gets the latest value that was fully written
+
+namespace dae
+{
+	template<typename T>
+	class TripleBuffer final
+	{
+	public:
+		TripleBuffer() = default;
+
+		TripleBuffer(const TripleBuffer&) = delete;
+		TripleBuffer(TripleBuffer&&) noexcept = delete;
+		TripleBuffer& operator=(const TripleBuffer&) = delete;
+		TripleBuffer& operator=(TripleBuffer&&) noexcept = delete;
+
+		//Writer: fill this buffer, then Publish it, it may hold any earlier value
+		T& GetWriteBuffer() { return m_Buffers[m_WriteIndex]; }
+
+		void Publish()
+		{
+			const uint8_t shared{ m_Shared.exchange(static_cast<uint8_t>(m_WriteIndex | m_IsNewFlag), std::memory_order_acq_rel) };
+			m_WriteIndex = shared & m_IndexMask;
+		}
+
+		//Reader: the latest published value, stays untouched until the next call
+		const T& Acquire()
+		{
+			if (m_Shared.load(std::memory_order_acquire) & m_IsNewFlag)
+			{
+				const uint8_t shared{ m_Shared.exchange(m_ReadIndex, std::memory_order_acq_rel) };
+				m_ReadIndex = shared & m_IndexMask;
+			}
+
+			return m_Buffers[m_ReadIndex];
+		}
+
+	private:
+		static constexpr uint8_t m_IndexMask{ 0b011 };
+		static constexpr uint8_t m_IsNewFlag{ 0b100 };
+
+		T m_Buffers[3]{};
+
+		//Index of the buffer in between the two threads, the flag is set when the writer put a new value there
+		std::atomic<uint8_t> m_Shared{ 1 };
+
+		uint8_t m_WriteIndex{ 0 };
+		uint8_t m_ReadIndex{ 2 };
+	};
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include <cassert>
 #include <fstream>
+#include <tuple>
+#include <unordered_map>
 #include "Math.h"
 #include "DataTypes.h"
 
@@ -34,6 +36,25 @@ namespace dae
 			vertices.clear();
 			indices.clear();
 
+			//Corners that use the same position, texcoord and normal share one vertex, so the mesh is properly indexed
+			//The key is the full (position, texcoord, normal) index triple, the map compares all three so corners only merge when they are equal
+			using VertexKey = std::tuple<size_t, size_t, size_t>;
+
+			struct VertexKeyHash
+			{
+				size_t operator()(const VertexKey& key) const
+				{
+					//boost style hash_combine of the three indices, a collision only costs a key comparison
+					size_t hash{ std::hash<size_t>{}(std::get<0>(key)) };
+					hash ^= std::hash<size_t>{}(std::get<1>(key)) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+					hash ^= std::hash<size_t>{}(std::get<2>(key)) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+					return hash;
+				}
+			};
+
+			std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertexIndices{};
+
 			std::string sCommand;
 			// start a while iteration ending when the end of file is reached (ios::eof)
 			while (!file.eof())
@@ -77,7 +98,7 @@ namespace dae
 					//
 					// Faces or triangles
 					Vertex vertex{};
-					size_t iPosition, iTexCoord, iNormal;
+					size_t iPosition, iTexCoord{}, iNormal{};
 
 					uint32_t tempIndices[3];
 					for (size_t iFace = 0; iFace < 3; iFace++)
@@ -107,8 +128,11 @@ namespace dae
 							}
 						}
 
-						vertices.push_back(vertex);
-						tempIndices[iFace] = uint32_t(vertices.size()) - 1;
+						const VertexKey key{ iPosition, iTexCoord, iNormal };
+						const auto [it, isNewVertex] { vertexIndices.try_emplace(key, uint32_t(vertices.size())) };
+
+						if (isNewVertex) vertices.push_back(vertex);
+						tempIndices[iFace] = it->second;
 						//indices.push_back(uint32_t(vertices.size()) - 1);
 					}
 
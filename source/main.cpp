@@ -5,7 +5,9 @@
 #undef main
 
 //Standard includes
+#include <atomic>
 #include <iostream>
+#include <thread>
 
 //Project includes
 #include "Timer.h"
@@ -47,10 +49,47 @@ int main(int argc, char* args[])
 	const auto pRenderer = new Renderer(pWindow);
 
 	//Start loop
+	//This thread handles input and updates the scene, the render thread draws the latest published snapshot of it
+	//Neither waits for the other
 	pTimer->Start();
-	float printTimer = 0.f;
-	bool isLooping = true;
-	bool takeScreenshot = false;
+	std::atomic<bool> isLooping = true;
+	std::atomic<bool> takeScreenshot = false;
+
+	std::thread renderThread{ [&]
+	{
+		Timer renderTimer{};
+		renderTimer.Start();
+		float printTimer = 0.f;
+
+		while (isLooping)
+		{
+			//--------- Render ---------
+			pRenderer->Render();
+
+			//--------- Timer ---------
+			renderTimer.Update();
+			printTimer += renderTimer.GetElapsed();
+			if (printTimer >= 1.f)
+			{
+				printTimer = 0.f;
+				std::cout << "dFPS: " << renderTimer.GetdFPS() << std::endl;
+				pRenderer->PrintCullStatistics();
+				pRenderer->PrintMemoryStatistics();
+			}
+
+			//Save screenshot after full render
+			if (takeScreenshot.exchange(false))
+			{
+				if (!pRenderer->SaveBufferToImage())
+					std::cout << "Screenshot saved!" << std::endl;
+				else
+					std::cout << "Something went wrong. Screenshot not saved!" << std::endl;
+			}
+		}
+
+		renderTimer.Stop();
+	} };
+
 	while (isLooping)
 	{
 		//--------- Get input events ---------
@@ -70,39 +109,35 @@ int main(int argc, char* args[])
 					pRenderer->ToggleCameraLock();
 				}
 				
-				if (e.key.keysym.scancode == SDL_SCANCODE_F4) pRenderer->ToggleColorState();
+				if (e.key.keysym.scancode == SDL_SCANCODE_F4) pRenderer->CycleShadingMode();
+
+				if (e.key.keysym.scancode == SDL_SCANCODE_F5) pRenderer->ToggleSIMDState();
+
+				if (e.key.keysym.scancode == SDL_SCANCODE_F6) pRenderer->ToggleFixedPointState();
+
+				if (e.key.keysym.scancode == SDL_SCANCODE_F7) pRenderer->CycleCullMode();
+
+				if (e.key.keysym.scancode == SDL_SCANCODE_F8) pRenderer->ToggleDepthPrePassState();
+
+				if (e.key.keysym.scancode == SDL_SCANCODE_F9) pRenderer->ToggleVisibilityBufferState();
+
+				if (e.key.keysym.scancode == SDL_SCANCODE_F10) pRenderer->ToggleMultisampleState();
 
 				break;
 			}
 		}
 
 		//--------- Update ---------
-		pRenderer->Update(pTimer);
-
-		//--------- Render ---------
-		pRenderer->Render();
-
-		//--------- Timer ---------
 		pTimer->Update();
-		printTimer += pTimer->GetElapsed();
-		if (printTimer >= 1.f)
-		{
-			printTimer = 0.f;
-			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
-		}
+		pRenderer->Update(pTimer);
 
-		//Save screenshot after full render
-		if (takeScreenshot)
-		{
-			if (!pRenderer->SaveBufferToImage())
-				std::cout << "Screenshot saved!" << std::endl;
-			else
-				std::cout << "Something went wrong. Screenshot not saved!" << std::endl;
-			takeScreenshot = false;
-		}
+		//The update is cheap, no need to spin a whole core on it
+		SDL_Delay(1);
 	}
 	pTimer->Stop();
 
+	renderThread.join();
+
 	//Shutdown "framework"
 	delete pRenderer;
 	delete pTimer;